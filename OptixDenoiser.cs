@@ -5,22 +5,279 @@ using UnityEngine;
 
 public static class OptixDenoiserWrapper
 {    
+    public const int BACKEND_AUTO  = 0;
+    public const int BACKEND_OPTIX = 1;
+    public const int BACKEND_CPU   = 2;
+
+    public const int FORMAT_FLOAT4 = 0;
+    public const int FORMAT_FLOAT3 = 1;
+    public const int FORMAT_HALF4  = 2;
+    public const int FORMAT_HALF3  = 3;
+
+    public const int GUIDE_ALBEDO  = 1;
+    public const int GUIDE_NORMAL  = 2;
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct MemoryRequirements
+    {
+        public ulong inputs;
+        public ulong outputs;
+        public ulong guides;
+        public ulong flow;
+        public ulong scratch;
+        public ulong state;
+        public ulong model;
+        public ulong device_total;
+        public ulong host_total;
+        public uint tile_width;
+        public uint tile_height;
+        public uint overlap;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct StageTiming
+    {
+        public double last_ms;
+        public double mean_ms;
+        public double min_ms;
+        public double max_ms;
+        public ulong samples;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct StageTimings
+    {
+        public StageTiming upload;
+        public StageTiming intensity;
+        public StageTiming invoke;
+        public StageTiming wait;
+        public StageTiming download;
+    }
+
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_create();
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_destroy(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_backend(System.IntPtr ctx, int backend);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_ctx_get_backend(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_persistent(System.IntPtr ctx, int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_host_staging(System.IntPtr ctx, int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_memory_budget(System.IntPtr ctx, ulong bytes);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_temporal(System.IntPtr ctx, int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_ctx_set_model_file(System.IntPtr ctx, string path);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_image_size(System.IntPtr ctx, uint width, uint height);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_input_format(System.IntPtr ctx, int format);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_guide_format(System.IntPtr ctx, int format);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_output_format(System.IntPtr ctx, int format);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_input_layout(System.IntPtr ctx, uint row_pitch, uint origin_x, uint origin_y);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_output_layout(System.IntPtr ctx, uint row_pitch, uint origin_x, uint origin_y);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_source_data_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_normal_data_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_albedo_data_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_flow_data_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_aov_count(System.IntPtr ctx, uint count);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_aov_data_pointer(System.IntPtr ctx, uint index, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_kernel_prediction(System.IntPtr ctx, int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_source_device_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_normal_device_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_albedo_device_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_output_device_pointer(System.IntPtr ctx, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_ctx_query_memory_requirements(System.IntPtr ctx, uint width, uint height, int guides, uint aovs, uint tile_width, uint tile_height, out MemoryRequirements requirements);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_init(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_update(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_exec(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern ulong optix_denoiser_ctx_exec_async(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_ctx_poll(System.IntPtr ctx, ulong ticket);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_wait(System.IntPtr ctx, ulong ticket);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_ctx_get_result(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_ctx_get_aov_result(System.IntPtr ctx, uint index);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_ctx_exec_region(System.IntPtr ctx, uint x, uint y, uint width, uint height);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_set_pipeline_depth(System.IntPtr ctx, uint depth);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern ulong optix_denoiser_ctx_submit_frame(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_ctx_poll_frame(System.IntPtr ctx, ulong frame);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_ctx_get_frame_result(System.IntPtr ctx, ulong frame);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_ctx_get_stage_timings(System.IntPtr ctx, out StageTimings timings);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_reset_stage_timings(System.IntPtr ctx);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_ctx_free(System.IntPtr ctx);
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ImageDesc
+    {
+        public uint width;
+        public uint height;
+        public System.IntPtr color;
+        public System.IntPtr albedo;
+        public System.IntPtr normal;
+        public System.IntPtr output;
+    }
+
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_ctx_denoise_batch(System.IntPtr ctx, ImageDesc[] images, uint count);
+
+    // invoked on the denoiser's worker thread
+    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+    public delegate void JobCallback(System.IntPtr job, int denoised, System.IntPtr user_data);
+
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_ctx_submit_job(System.IntPtr ctx, ref ImageDesc image, JobCallback callback, System.IntPtr user_data);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_job_poll(System.IntPtr job);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_job_wait(System.IntPtr job);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_job_release(System.IntPtr job);
+
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_device_pool_create(int backend, uint device_count);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_device_pool_destroy(System.IntPtr pool);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern uint optix_denoiser_device_pool_size(System.IntPtr pool);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_device_pool_denoise_batch(System.IntPtr pool, ImageDesc[] images, uint count);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_device_pool_denoise_sharded(System.IntPtr pool, ref ImageDesc image);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_device_pool_get_device_stats(System.IntPtr pool, uint device, out double pixels_per_second, out ulong pixels_denoised);
+
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_alloc_host_buffer(ulong size_in_bytes);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_free_host_buffer(System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_trim_device_memory();
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_clear_model_cache();
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_log_level(int level);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_flush_log();
+
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_backend(int backend);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_get_backend();
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_persistent(int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_host_staging(int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_memory_budget(ulong bytes);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_temporal(int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_set_model_file(string path);
     [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_set_image_size(uint width, uint height);
     [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_input_format(int format);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_guide_format(int format);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_output_format(int format);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_input_layout(uint row_pitch, uint origin_x, uint origin_y);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_output_layout(uint row_pitch, uint origin_x, uint origin_y);
+    [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_set_source_data_pointer(System.IntPtr ptr);
     [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_set_normal_data_pointer(System.IntPtr ptr);
     [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_set_albedo_data_pointer(System.IntPtr ptr);
     [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_flow_data_pointer(System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_aov_count(uint count);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_aov_data_pointer(uint index, System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_kernel_prediction(int enabled);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_source_device_pointer(System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_normal_device_pointer(System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_albedo_device_pointer(System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_output_device_pointer(System.IntPtr ptr);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_query_memory_requirements(uint width, uint height, int guides, uint aovs, uint tile_width, uint tile_height, out MemoryRequirements requirements);
+    [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_init();
     [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_update();
     [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_exec();
     [DllImport("OptixDenoiserWrapper")]
+    private static extern ulong optix_denoiser_exec_async();
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_poll(ulong ticket);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_wait(ulong ticket);
+    [DllImport("OptixDenoiserWrapper")]
     private static extern System.IntPtr optix_denoiser_get_result();
     [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_get_aov_result(uint index);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_exec_region(uint x, uint y, uint width, uint height);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_set_pipeline_depth(uint depth);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern ulong optix_denoiser_submit_frame();
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_poll_frame(ulong frame);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_get_frame_result(ulong frame);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_get_stage_timings(out StageTimings timings);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern void optix_denoiser_reset_stage_timings();
+    [DllImport("OptixDenoiserWrapper")]
     private static extern void optix_denoiser_free();
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern int optix_denoiser_denoise_batch(ImageDesc[] images, uint count);
+    [DllImport("OptixDenoiserWrapper")]
+    private static extern System.IntPtr optix_denoiser_submit_job(ref ImageDesc image, JobCallback callback, System.IntPtr user_data);
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#pragma once
+#include <stddef.h>
+#include <algorithm>
+#include <iterator>
+#include <map>
+
+// First-fit sub-allocator handing out aligned ranges of [0, capacity). It only does the
+// bookkeeping; the memory itself (e.g. one device slab) belongs to the caller. Neighbouring
+// free ranges are merged on release, so once everything is released the arena is a single
+// free range again and long sessions do not fragment it.
+class ArenaAllocator
+{
+public:
+    static const size_t kInvalid = ~size_t( 0 );
+
+    explicit ArenaAllocator( size_t capacity = 0, size_t alignment = 256 )
+        : m_capacity( capacity / alignment * alignment )
+        , m_alignment( alignment )
+    {
+        if( m_capacity > 0 )
+            m_free[0] = m_capacity;
+    }
+
+    // offset of a range of at least bytes, or kInvalid if no free range is large enough
+    size_t allocate( size_t bytes )
+    {
+        const size_t size = ( std::max<size_t>( bytes, 1 ) + m_alignment - 1 ) / m_alignment * m_alignment;
+        for( auto it = m_free.begin(); it != m_free.end(); ++it )
+        {
+            if( it->second < size )
+                continue;
+            const size_t offset = it->first;
+            const size_t rest   = it->second - size;
+            m_free.erase( it );
+            if( rest > 0 )
+                m_free[offset + size] = rest;
+            m_used[offset] = size;
+            m_usedBytes += size;
+            return offset;
+        }
+        return kInvalid;
+    }
+
+    // give back a range returned by allocate; unknown offsets are ignored
+    void release( size_t offset )
+    {
+        auto used = m_used.find( offset );
+        if( used == m_used.end() )
+            return;
+        size_t size = used->second;
+        m_usedBytes -= size;
+        m_used.erase( used );
+
+        auto next = m_free.lower_bound( offset );
+        if( next != m_free.end() && next->first == offset + size )
+        {
+            size += next->second;
+            next = m_free.erase( next );
+        }
+        if( next != m_free.begin() )
+        {
+            auto prev = std::prev( next );
+            if( prev->first + prev->second == offset )
+            {
+                prev->second += size;
+                return;
+            }
+        }
+        m_free[offset] = size;
+    }
+
+    bool   contains( size_t offset ) const { return m_used.count( offset ) != 0; }
+    bool   empty() const { return m_used.empty(); }
+    size_t capacity() const { return m_capacity; }
+    size_t used() const { return m_usedBytes; }
+
+    size_t largestFree() const
+    {
+        size_t largest = 0;
+        for( const auto& range : m_free )
+            largest = std::max( largest, range.second );
+        return largest;
+    }
+
+private:
+    std::map< size_t, size_t > m_free;     // offset -> size
+    std::map< size_t, size_t > m_used;     // offset -> size
+    size_t                     m_capacity  = 0;
+    size_t                     m_alignment = 256;
+    size_t                     m_usedBytes = 0;
+};
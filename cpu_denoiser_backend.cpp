@@ -0,0 +1,718 @@
+#include "denoiser_backend.h"
+#include "debug.h"
+#include "flow_warp.h"
+#include "parallel_rows.h"
+#include "pixel_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <thread>
+
+// Reference denoiser running on the host. It follows the same init/update/exec/getResults
+// lifecycle and memory layout as the OptiX backend (inputs are copied into backend owned
+// buffers on update, results copied out on getResults), so the whole pipeline can run on
+// machines without a CUDA device. The filter itself is an edge-avoiding a-trous wavelet
+// filter guided by albedo and normal, not a trained model.
+
+static inline float luminance( const float4& c )
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+static inline float distanceSquared( const float4& a, const float4& b )
+{
+    const float dx = a.x - b.x;
+    const float dy = a.y - b.y;
+    const float dz = a.z - b.z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+class CPUDenoiser : public DenoiserBackend
+{
+public:
+    bool init( const Data&  data,
+               unsigned int tileWidth = 0,
+               unsigned int tileHeight = 0,
+               bool         kpMode = false,
+               bool         temporalMode = false ) override;
+
+    DenoiserMemoryRequirements queryMemoryRequirements( const DenoiserConfig& config ) override;
+
+    void exec() override;
+
+    uint64_t execAsync() override;
+
+    bool poll( uint64_t ticket ) override;
+
+    void wait( uint64_t ticket ) override;
+
+    void update( const Data& data ) override;
+
+    void getResults() override;
+
+    void finish() override;
+
+    void getFlowResults() override;
+
+    void execRegion( const Data& data, unsigned int x, unsigned int y, unsigned int width, unsigned int height ) override;
+
+    void setExposure( const DenoiserExposure* exposure ) override;
+
+    void setPipelineDepth( unsigned int depth ) override;
+
+    uint64_t submitFrame( const Data& data ) override;
+
+    bool pollFrame( uint64_t frame ) override;
+
+    const float* frameResult( uint64_t frame, size_t layer ) override;
+
+    StageStatistics stageStatistics( DenoiserStage stage ) override { return m_timings.statistics( stage ); }
+    void            resetStageTimings() override { m_timings.reset(); }
+
+    DenoiserBackendKind kind() const override { return DenoiserBackendKind::CPU; }
+    const char*         name() const override { return "CPU"; }
+
+private:
+    struct Layer
+    {
+        std::vector< float4 > input;
+        std::vector< float4 > output;
+    };
+
+    // the images one denoise pass reads and writes; scratch and history are shared
+    struct Frame
+    {
+        unsigned int          width  = 0;
+        unsigned int          height = 0;
+        std::vector< Layer >  layers;
+        std::vector< float4 > albedo;
+        std::vector< float4 > normal;
+        std::vector< float4 > flow;
+    };
+
+    struct FrameSlot
+    {
+        Frame                    frame;
+        uint64_t                 id = 0;
+        std::shared_future<void> done;
+        std::vector< std::vector< unsigned char > > results;    // outputs converted to m_outputFormat
+    };
+
+    void reserveImage( std::vector< float4 >& image ) const;
+    void setHostOutputs( const Data& data );
+    // copy the host inputs of data into frame
+    void uploadFrame( Frame& frame, const Data& data );
+    // the actual denoise pass, shared by exec, execAsync and submitFrame
+    void run( Frame& frame );
+    // queue run( frame ) behind all previously queued passes
+    std::shared_future<void> enqueue( Frame& frame );
+    void waitAll();
+    void computeIntensity( const Frame& frame );
+    void filterLayer( const Frame& frame, Layer& layer );
+
+    // a-trous iterations of filterLayer, and the resulting reach: pixels further than this from
+    // the border of a window are filtered exactly as in the full image
+    static const int kIterations   = 3;
+    static const int kFilterRadius = 2 * ( ( 1 << kIterations ) - 1 );
+    void blendHistory( const Frame& frame, Layer& layer, std::vector< float4 >& history );
+
+    unsigned int          m_width        = 0;
+    unsigned int          m_height       = 0;
+    bool                  m_temporalMode = false;
+    float                 m_intensity    = 1.0f;
+    bool                  m_exposureFixed = false;
+    DenoiserExposure      m_exposure;         // used instead of computeIntensity if fixed
+
+    Frame                 m_frame;
+    std::vector< float4 > m_scratch;
+    std::vector< std::vector< float4 > > m_history;    // previous output per layer, temporal mode
+    std::vector< float4 > m_warpBuffer;        // getFlowResults: warped layers, kept between calls
+    std::vector< float* > m_host_outputs;      // start of the output region
+    size_t                m_outputRowStride = 0;
+    DenoiserPixelFormat   m_outputFormat = DenoiserPixelFormat::Float4;
+
+    // passes run on worker threads, one after another (the filter already uses all cores and
+    // passes share scratch and history). Buffers are only touched again after waiting.
+    std::shared_future<void> m_tail;
+    std::deque< std::pair< uint64_t, std::shared_future<void> > > m_inFlight;
+    uint64_t              m_lastTicket      = 0;
+    uint64_t              m_completedTicket = 0;
+
+    std::vector< FrameSlot > m_slots;
+    unsigned int          m_pipelineDepth = 2;
+    uint64_t              m_lastFrame     = 0;
+
+    StageTimings          m_timings;      // Intensity and Invoke are recorded by the worker
+};
+
+DenoiserMemoryRequirements CPUDenoiser::queryMemoryRequirements( const DenoiserConfig& config )
+{
+    // every image is expanded to float4 at the bucketed size; device pointers and tiling do not
+    // apply to the host filter
+    const size_t image  = size_t( bucketImageDimension( config.width ) ) * bucketImageDimension( config.height ) * sizeof( float4 );
+    const size_t layers = 1 + config.aovs;
+
+    DenoiserMemoryRequirements requirements;
+    requirements.inputs  = layers * image;
+    requirements.outputs = layers * image;
+    requirements.guides  = ( ( config.albedo ? 1 : 0 ) + ( config.normal ? 1 : 0 ) ) * image;
+    requirements.flow    = config.temporalMode ? image : 0;
+    requirements.scratch = image + ( config.temporalMode ? layers * image : 0 );
+    requirements.regionOverlap = kFilterRadius;
+    return requirements;
+}
+
+// reserve the bucketed size of the current resolution
+void CPUDenoiser::reserveImage( std::vector< float4 >& image ) const
+{
+    image.reserve( size_t( bucketImageDimension( m_width ) ) * bucketImageDimension( m_height ) );
+}
+
+// expand the w x h rectangle at (x, y) of the input region of a caller image into the same
+// rectangle of dst, a tightly packed data.width x data.height float4 image
+static void copyImageRect( std::vector< float4 >& dst, float* src, const DenoiserData& data, DenoiserPixelFormat format,
+                           unsigned int x, unsigned int y, unsigned int w, unsigned int h )
+{
+    const size_t pitch = data.inputLayout.rowStrideInBytes( data.width, format );
+    const char*  start = reinterpret_cast<const char*>( data.inputLayout.regionStart( src, data.width, format ) );
+    for( unsigned int row = 0; row < h; row++ )
+        convertToFloat4( &dst[size_t( y + row ) * data.width + x], start + ( y + row ) * pitch + size_t( x ) * pixelSizeInBytes( format ), format, w );
+}
+
+// expand the input region of a caller image into tightly packed float4 pixels
+static void copyImage( std::vector< float4 >& dst, float* src, const DenoiserData& data,
+                       DenoiserPixelFormat format = DenoiserPixelFormat::Float4 )
+{
+    dst.resize( size_t( data.width ) * data.height );
+    if( src )
+        convertImageToFloat4( dst.data(), data.inputLayout.regionStart( src, data.width, format ),
+                              data.inputLayout.rowStrideInBytes( data.width, format ), format, data.width, data.height );
+}
+
+// copy the w x h rectangle at (x, y) of a width pixels wide image to (dx, dy) of another
+static void copyRect( std::vector< float4 >& dst, unsigned int dst_width, unsigned int dx, unsigned int dy,
+                      const std::vector< float4 >& src, unsigned int src_width, unsigned int x, unsigned int y,
+                      unsigned int w, unsigned int h )
+{
+    for( unsigned int row = 0; row < h; row++ )
+        memcpy( &dst[size_t( dy + row ) * dst_width + dx], &src[size_t( y + row ) * src_width + x], w * sizeof( float4 ) );
+}
+
+void CPUDenoiser::setHostOutputs( const Data& data )
+{
+    m_outputFormat    = data.outputFormat;
+    m_outputRowStride = data.outputLayout.rowStrideInBytes( data.width, data.outputFormat );
+    m_host_outputs.resize( data.outputs.size() );
+    for( size_t i=0; i < data.outputs.size(); i++ )
+        m_host_outputs[i] = data.outputLayout.regionStart( data.outputs[i], data.width, data.outputFormat );
+}
+
+bool CPUDenoiser::init( const Data&  data,
+                        unsigned int tileWidth,
+                        unsigned int tileHeight,
+                        bool         kpMode,
+                        bool         temporalMode )
+{
+    if( const char* reason = invalidInitReason( data, tileWidth, tileHeight ) )
+    {
+        LOG_ERROR( "Denoiser init failed: %s", reason );
+        return false;
+    }
+    if( temporalMode && ( kpMode || !data.aovs.empty() ) )
+    {
+        LOG_ERROR( "Denoiser init failed: temporal mode does not support AOVs or kernel prediction" );
+        return false;
+    }
+
+    waitAll();
+
+    setHostOutputs( data );
+    m_temporalMode = temporalMode;
+    m_width        = data.width;
+    m_height       = data.height;
+
+    // init may be called again on a live backend. Buffers are resized in place, so they keep
+    // their capacity and a resolution that fits the previous allocation does not reallocate.
+    m_frame.layers.resize( 1 + data.aovs.size() );
+    uploadFrame( m_frame, data );
+    if( m_temporalMode )
+        m_frame.flow.assign( size_t( m_width ) * m_height, float4{ 0.f, 0.f, 0.f, 0.f } );    // first frame, zero motion
+
+    m_history.resize( m_frame.layers.size() );
+    for( size_t i=0; i < m_history.size(); i++ )
+        m_history[i].clear();
+
+    reserveImage( m_scratch );
+    m_scratch.resize( size_t( m_width ) * m_height );
+
+    // pipeline slots keep their buffers, uploadFrame resizes them for the new configuration;
+    // results of earlier frames are gone
+    for( size_t i=0; i < m_slots.size(); i++ )
+        m_slots[i].id = 0;
+    return true;
+}
+
+void CPUDenoiser::uploadFrame( Frame& frame, const Data& data )
+{
+    const size_t pixels = size_t( m_width ) * m_height;
+
+    frame.width  = m_width;
+    frame.height = m_height;
+    frame.layers.resize( m_frame.layers.size() );
+    for( size_t i=0; i < frame.layers.size(); i++ )
+    {
+        Layer& layer = frame.layers[i];
+        reserveImage( layer.input );
+        reserveImage( layer.output );
+        if( i == 0 || i - 1 < data.aovs.size() )
+            copyImage( layer.input, i == 0 ? data.color : data.aovs[i - 1], data, data.inputFormat );
+        layer.output.resize( pixels );
+    }
+
+    frame.albedo.clear();
+    frame.normal.clear();
+    if( data.albedo )
+        copyImage( frame.albedo, data.albedo, data, data.guideFormat );
+    if( data.normal )
+        copyImage( frame.normal, data.normal, data, data.guideFormat );
+    // no flow means no motion, not the previous frame's vectors
+    if( m_temporalMode && data.flow )
+        copyImage( frame.flow, data.flow, data );
+    else if( m_temporalMode )
+        frame.flow.assign( pixels, float4{ 0.f, 0.f, 0.f, 0.f } );
+}
+
+void CPUDenoiser::update( const Data& data )
+{
+    SUTIL_ASSERT_MSG( !data.normal || data.albedo, "Currently albedo is required if normal input is given" );
+
+    // the frame buffers keep the size and layers of init; a new size needs a new init
+    if( m_frame.layers.empty() || !data.color || data.outputs.empty() || !data.outputs[0]
+        || data.width != m_width || data.height != m_height || data.aovs.size() + 1 != m_frame.layers.size() )
+    {
+        LOG_ERROR( "Denoiser update skipped: the data does not match the last init" );
+        return;
+    }
+
+    wait( m_lastTicket );
+
+    ScopedStageTimer timer( m_timings, DenoiserStage::Upload );
+    setHostOutputs( data );
+    uploadFrame( m_frame, data );
+}
+
+// counterpart of optixDenoiserComputeIntensity: scale that maps the log-average luminance to middle grey
+void CPUDenoiser::computeIntensity( const Frame& frame )
+{
+    if( m_exposureFixed )
+    {
+        m_intensity = m_exposure.intensity;
+        return;
+    }
+    const std::vector< float4 >& color = frame.layers[0].input;
+
+    double sum   = 0.0;
+    size_t count = 0;
+    for( size_t i=0; i < color.size(); i++ )
+    {
+        const float lum = luminance( color[i] );
+        if( lum > 1e-8f && std::isfinite( lum ) )
+        {
+            sum += std::log( lum );
+            count++;
+        }
+    }
+    m_intensity = count ? 0.18f / float( std::exp( sum / double( count ) ) ) : 1.0f;
+}
+
+void CPUDenoiser::filterLayer( const Frame& frame, Layer& layer )
+{
+    static const float kernel[5]  = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+    static const int   iterations = kIterations;
+
+    const int   width       = int( frame.width );
+    const int   height      = int( frame.height );
+    const bool  has_albedo  = !frame.albedo.empty();
+    const bool  has_normal  = !frame.normal.empty();
+    const float intensity2  = m_intensity * m_intensity;
+    const std::vector< float4 >& albedo = frame.albedo;
+    const std::vector< float4 >& normal = frame.normal;
+
+    // ping-pong between output and scratch so that the last iteration lands in output
+    const std::vector< float4 >* src = &layer.input;
+    std::vector< float4 >*       dst = ( iterations % 2 ) ? &layer.output : &m_scratch;
+
+    for( int it = 0; it < iterations; it++ )
+    {
+        const int   step    = 1 << it;
+        const float sigma_c = 0.25f / float( step );
+
+        parallelRows( frame.height, [&]( unsigned int y_begin, unsigned int y_end )
+        {
+            for( int y = int( y_begin ); y < int( y_end ); y++ )
+            {
+                for( int x = 0; x < width; x++ )
+                {
+                    const size_t  p  = size_t( y ) * width + x;
+                    const float4& cp = ( *src )[p];
+
+                    float4 sum     = { 0.f, 0.f, 0.f, 0.f };
+                    float  sum_w   = 0.f;
+                    for( int j = -2; j <= 2; j++ )
+                    {
+                        const int qy = std::min( std::max( y + j * step, 0 ), height - 1 );
+                        for( int i = -2; i <= 2; i++ )
+                        {
+                            const int     qx = std::min( std::max( x + i * step, 0 ), width - 1 );
+                            const size_t  q  = size_t( qy ) * width + qx;
+                            const float4& cq = ( *src )[q];
+
+                            float w = kernel[i + 2] * kernel[j + 2];
+                            w *= std::exp( -distanceSquared( cp, cq ) * intensity2 / sigma_c );
+                            if( has_albedo )
+                                w *= std::exp( -distanceSquared( albedo[p], albedo[q] ) / 0.01f );
+                            if( has_normal )
+                            {
+                                const float4& np = normal[p];
+                                const float4& nq = normal[q];
+                                const float   d  = std::max( 0.f, np.x * nq.x + np.y * nq.y + np.z * nq.z );
+                                w *= std::pow( d, 32.f );
+                            }
+
+                            sum.x += w * cq.x;
+                            sum.y += w * cq.y;
+                            sum.z += w * cq.z;
+                            sum_w += w;
+                        }
+                    }
+
+                    float4& out = ( *dst )[p];
+                    out.x = sum_w > 0.f ? sum.x / sum_w : cp.x;
+                    out.y = sum_w > 0.f ? sum.y / sum_w : cp.y;
+                    out.z = sum_w > 0.f ? sum.z / sum_w : cp.z;
+                    out.w = layer.input[p].w;   // alpha passes through, as with denoiseAlpha = 0
+                }
+            }
+        } );
+
+        src = dst;
+        dst = ( dst == &layer.output ) ? &m_scratch : &layer.output;
+    }
+}
+
+// temporal mode: blend with the previous output reprojected along the flow vectors
+void CPUDenoiser::blendHistory( const Frame& frame, Layer& layer, std::vector< float4 >& history )
+{
+    if( history.empty() )
+    {
+        history = layer.output;     // first frame
+        return;
+    }
+
+    const int width  = int( frame.width );
+    const int height = int( frame.height );
+    const std::vector< float4 >& flow = frame.flow;
+
+    parallelRows( frame.height, [&]( unsigned int y_begin, unsigned int y_end )
+    {
+        for( int y = int( y_begin ); y < int( y_end ); y++ )
+        {
+            for( int x = 0; x < width; x++ )
+            {
+                const size_t p  = size_t( y ) * width + x;
+                const int    px = std::min( std::max( int( std::floor( x - flow[p].x + 0.5f ) ), 0 ), width - 1 );
+                const int    py = std::min( std::max( int( std::floor( y - flow[p].y + 0.5f ) ), 0 ), height - 1 );
+
+                const float4& prev = history[size_t( py ) * width + px];
+                float4&       out  = layer.output[p];
+                out.x = 0.2f * out.x + 0.8f * prev.x;
+                out.y = 0.2f * out.y + 0.8f * prev.y;
+                out.z = 0.2f * out.z + 0.8f * prev.z;
+            }
+        }
+    } );
+
+    history = layer.output;
+}
+
+void CPUDenoiser::exec()
+{
+    waitAll();
+    run( m_frame );
+}
+
+void CPUDenoiser::run( Frame& frame )
+{
+    if( frame.layers.empty() )
+        return;
+
+    // pipelined frames are not timed, as on the OptiX backend
+    ScopedStageTimer intensity( m_timings, DenoiserStage::Intensity );
+    if( &frame != &m_frame )
+        intensity.cancel();
+    computeIntensity( frame );
+    intensity.stop();
+
+    ScopedStageTimer invoke( m_timings, DenoiserStage::Invoke );
+    if( &frame != &m_frame )
+        invoke.cancel();
+    for( size_t i=0; i < frame.layers.size(); i++ )
+    {
+        filterLayer( frame, frame.layers[i] );
+        if( m_temporalMode )
+            blendHistory( frame, frame.layers[i], m_history[i] );
+    }
+}
+
+std::shared_future<void> CPUDenoiser::enqueue( Frame& frame )
+{
+    std::shared_future<void> previous = m_tail;
+    m_tail = std::async( std::launch::async, [this, &frame, previous]()
+    {
+        if( previous.valid() )
+            previous.wait();
+        run( frame );
+    } ).share();
+    return m_tail;
+}
+
+void CPUDenoiser::waitAll()
+{
+    if( m_tail.valid() )
+        m_tail.wait();
+    wait( m_lastTicket );
+}
+
+uint64_t CPUDenoiser::execAsync()
+{
+    m_inFlight.push_back( std::make_pair( ++m_lastTicket, enqueue( m_frame ) ) );
+    return m_lastTicket;
+}
+
+bool CPUDenoiser::poll( uint64_t ticket )
+{
+    while( !m_inFlight.empty()
+           && m_inFlight.front().second.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready )
+    {
+        m_completedTicket = m_inFlight.front().first;
+        m_inFlight.pop_front();
+    }
+    return ticket <= m_completedTicket;
+}
+
+void CPUDenoiser::wait( uint64_t ticket )
+{
+    ScopedStageTimer timer( m_timings, DenoiserStage::Wait );
+    if( m_inFlight.empty() || m_inFlight.front().first > ticket )
+        timer.cancel();
+    while( !m_inFlight.empty() && m_inFlight.front().first <= ticket )
+    {
+        m_inFlight.front().second.wait();
+        m_completedTicket = m_inFlight.front().first;
+        m_inFlight.pop_front();
+    }
+}
+
+void CPUDenoiser::setPipelineDepth( unsigned int depth )
+{
+    depth = std::min( std::max( depth, 1u ), 3u );
+    if( depth == m_pipelineDepth )
+        return;
+    waitAll();
+    m_slots.clear();
+    m_pipelineDepth = depth;
+}
+
+// Pipelined frame: the inputs are copied into a free slot on the calling thread while earlier
+// frames are still being denoised on the worker.
+uint64_t CPUDenoiser::submitFrame( const Data& data )
+{
+    SUTIL_ASSERT( data.color  );
+    SUTIL_ASSERT( data.width == m_width );
+    SUTIL_ASSERT( data.height == m_height );
+    SUTIL_ASSERT_MSG( !data.normal || data.albedo, "Currently albedo is required if normal input is given" );
+
+    if( m_frame.layers.empty() || data.width != m_width || data.height != m_height )
+        return 0;
+    if( m_slots.empty() )
+        m_slots.resize( m_pipelineDepth );
+
+    FrameSlot& slot = m_slots[m_lastFrame % m_slots.size()];
+    if( slot.done.valid() )
+        slot.done.wait();
+
+    slot.id = ++m_lastFrame;
+    uploadFrame( slot.frame, data );
+    slot.done = enqueue( slot.frame );
+    return slot.id;
+}
+
+bool CPUDenoiser::pollFrame( uint64_t frame )
+{
+    // 0 is what a failed submitFrame returns, and the id of slots never submitted
+    if( frame == 0 || frame > m_lastFrame )
+        return false;
+    for( size_t i=0; i < m_slots.size(); i++ )
+    {
+        if( m_slots[i].id == frame && m_slots[i].done.valid() )
+            return m_slots[i].done.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready;
+    }
+    return true;    // slot already reused, so the frame has long completed
+}
+
+const float* CPUDenoiser::frameResult( uint64_t frame, size_t layer )
+{
+    if( frame == 0 )
+        return nullptr;
+    for( size_t i=0; i < m_slots.size(); i++ )
+    {
+        FrameSlot& slot = m_slots[i];
+        if( slot.id != frame || !slot.done.valid() || layer >= slot.frame.layers.size() )
+            continue;
+        slot.done.wait();
+        const std::vector< float4 >& output = slot.frame.layers[layer].output;
+        if( m_outputFormat == DenoiserPixelFormat::Float4 )
+            return reinterpret_cast<const float*>( output.data() );
+
+        slot.results.resize( slot.frame.layers.size() );
+        slot.results[layer].resize( output.size() * pixelSizeInBytes( m_outputFormat ) );
+        convertFromFloat4( slot.results[layer].data(), output.data(), m_outputFormat, output.size() );
+        return reinterpret_cast<const float*>( slot.results[layer].data() );
+    }
+    return nullptr;
+}
+
+void CPUDenoiser::execRegion( const Data& data, unsigned int x, unsigned int y, unsigned int width, unsigned int height )
+{
+    SUTIL_ASSERT_MSG( !m_temporalMode, "region denoising is not available in temporal mode" );
+    SUTIL_ASSERT( data.width == m_width && data.height == m_height );
+    if( m_temporalMode || m_frame.layers.empty() || data.width != m_width || data.height != m_height
+        || x >= m_width || y >= m_height )
+        return;
+    width  = std::min( width, m_width - x );
+    height = std::min( height, m_height - y );
+
+    waitAll();
+    setHostOutputs( data );
+
+    // the rectangle plus the reach of the filter
+    const unsigned int margin = kFilterRadius;
+    const unsigned int wx = x > margin ? x - margin : 0;
+    const unsigned int wy = y > margin ? y - margin : 0;
+    const unsigned int ww = std::min( x + width + margin, m_width ) - wx;
+    const unsigned int wh = std::min( y + height + margin, m_height ) - wy;
+
+    // refresh the inputs of the window; the rest of the frame keeps its previous contents
+    for( size_t i=0; i < m_frame.layers.size(); i++ )
+    {
+        float* src = i == 0 ? data.color : ( i - 1 < data.aovs.size() ? data.aovs[i - 1] : nullptr );
+        if( src )
+            copyImageRect( m_frame.layers[i].input, src, data, data.inputFormat, wx, wy, ww, wh );
+    }
+    if( data.albedo && !m_frame.albedo.empty() )
+        copyImageRect( m_frame.albedo, data.albedo, data, data.guideFormat, wx, wy, ww, wh );
+    if( data.normal && !m_frame.normal.empty() )
+        copyImageRect( m_frame.normal, data.normal, data, data.guideFormat, wx, wy, ww, wh );
+
+    // exposure of the whole frame, so the region matches its surroundings
+    computeIntensity( m_frame );
+
+    // filter a copy of the window and merge the rectangle into the outputs
+    Frame window;
+    window.width  = ww;
+    window.height = wh;
+    window.layers.resize( m_frame.layers.size() );
+    if( !m_frame.albedo.empty() )
+    {
+        window.albedo.resize( size_t( ww ) * wh );
+        copyRect( window.albedo, ww, 0, 0, m_frame.albedo, m_width, wx, wy, ww, wh );
+    }
+    if( !m_frame.normal.empty() )
+    {
+        window.normal.resize( size_t( ww ) * wh );
+        copyRect( window.normal, ww, 0, 0, m_frame.normal, m_width, wx, wy, ww, wh );
+    }
+
+    const size_t pixel_size = pixelSizeInBytes( m_outputFormat );
+    for( size_t i=0; i < m_frame.layers.size(); i++ )
+    {
+        Layer& layer = window.layers[i];
+        layer.input.resize( size_t( ww ) * wh );
+        layer.output.resize( size_t( ww ) * wh );
+        copyRect( layer.input, ww, 0, 0, m_frame.layers[i].input, m_width, wx, wy, ww, wh );
+        filterLayer( window, layer );
+
+        std::vector< float4 >& output = m_frame.layers[i].output;
+        copyRect( output, m_width, x, y, layer.output, ww, x - wx, y - wy, width, height );
+
+        if( i < m_host_outputs.size() )
+        {
+            char* dst = reinterpret_cast<char*>( m_host_outputs[i] );
+            for( unsigned int row = y; row < y + height; row++ )
+                convertFromFloat4( dst + row * m_outputRowStride + x * pixel_size, &output[size_t( row ) * m_width + x], m_outputFormat, width );
+        }
+    }
+}
+
+void CPUDenoiser::getFlowResults()
+{
+    wait( m_lastTicket );
+    if( m_frame.layers.size() == 0 || m_frame.flow.empty() )
+        return;
+
+    // all layers in one pass, sharing the filter weights
+    const size_t pixels = size_t( m_width ) * m_height;
+    const size_t layers = m_frame.layers.size();
+    m_warpBuffer.resize( layers * pixels );
+    std::vector< float4* >       results( layers );
+    std::vector< const float4* > images( layers );
+    for( size_t i=0; i < layers; i++ )
+    {
+        results[i] = m_warpBuffer.data() + i * pixels;
+        images[i]  = m_frame.layers[i].input.data();
+    }
+    warpImages( results.data(), images.data(), layers, m_frame.flow.data(), m_width, m_height );
+
+    for( size_t i=0; i < layers && i < m_host_outputs.size(); i++ )
+        convertImageFromFloat4( m_host_outputs[i], m_outputRowStride, results[i], m_outputFormat, m_width, m_height );
+}
+
+void CPUDenoiser::getResults()
+{
+    wait( m_lastTicket );
+
+    ScopedStageTimer timer( m_timings, DenoiserStage::Download );
+    for( size_t i=0; i < m_frame.layers.size() && i < m_host_outputs.size(); i++ )
+        convertImageFromFloat4( m_host_outputs[i], m_outputRowStride, m_frame.layers[i].output.data(), m_outputFormat, m_width, m_height );
+}
+
+void CPUDenoiser::setExposure( const DenoiserExposure* exposure )
+{
+    // passes on the worker read the exposure
+    waitAll();
+    m_exposureFixed = exposure != nullptr;
+    if( exposure )
+        m_exposure = *exposure;
+}
+
+void CPUDenoiser::finish()
+{
+    waitAll();
+    m_exposureFixed = false;
+
+    // Cleanup resources
+    m_frame = Frame();
+    std::vector< float4 >().swap( m_scratch );
+    std::vector< std::vector< float4 > >().swap( m_history );
+    std::vector< float4 >().swap( m_warpBuffer );
+    std::vector< FrameSlot >().swap( m_slots );
+    m_host_outputs.clear();
+}
+
+std::unique_ptr<DenoiserBackend> createCPUDenoiser()
+{
+    return std::unique_ptr<DenoiserBackend>( new CPUDenoiser() );
+}
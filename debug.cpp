@@ -0,0 +1,196 @@
+#include "debug.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+// One message. sequence tells producers and the consumer whose turn the slot is (a bounded
+// queue after Vyukov): equal to the enqueue position when free, position + 1 when published.
+struct LogSlot
+{
+    std::atomic<size_t> sequence{ 0 };
+    LogLevel            level  = LogLevel::Info;
+    Color               color  = Color::Black;
+    int                 length = 0;
+    char                text[256];
+};
+
+// Multi-producer ring of preallocated slots drained by one flush thread. Producers claim a
+// slot with a compare-exchange, format into it and publish it; they never wait for the
+// consumer to drain and drop the message if the ring is full.
+class LogRing
+{
+public:
+    static const size_t kSlots = 512;    // power of two
+
+    LogRing()
+    {
+        for( size_t i = 0; i < kSlots; i++ )
+            m_slots[i].sequence.store( i, std::memory_order_relaxed );
+    }
+
+    void push( LogLevel level, Color color, const char* format, va_list args )
+    {
+        size_t   position = m_enqueue.load( std::memory_order_relaxed );
+        LogSlot* slot     = nullptr;
+        for( ;; )
+        {
+            slot = &m_slots[position & ( kSlots - 1 )];
+            const size_t   sequence   = slot->sequence.load( std::memory_order_acquire );
+            const intptr_t difference = intptr_t( sequence ) - intptr_t( position );
+            if( difference == 0 )
+            {
+                if( m_enqueue.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if( difference < 0 )
+            {
+                m_dropped.fetch_add( 1, std::memory_order_relaxed );
+                return;
+            }
+            else
+            {
+                position = m_enqueue.load( std::memory_order_relaxed );
+            }
+        }
+
+        const int length = vsnprintf( slot->text, sizeof( slot->text ), format, args );
+        slot->length = length < 0 ? 0 : std::min( length, int( sizeof( slot->text ) ) - 1 );
+        slot->level  = level;
+        slot->color  = color;
+        slot->sequence.store( position + 1, std::memory_order_release );
+
+        // one wake-up per burst, notified under the mutex so that the flusher cannot miss it
+        // between checking for messages and going to sleep
+        if( !m_wakePending.exchange( true, std::memory_order_acq_rel ) )
+        {
+            std::lock_guard<std::mutex> lock( m_wakeMutex );
+            m_wake.notify_one();
+        }
+    }
+
+    // Pass on all published messages; consumers are serialized by m_drainMutex. Returns true if
+    // anything was written to stdout.
+    bool drain( FuncCallBack callback )
+    {
+        std::lock_guard<std::mutex> lock( m_drainMutex );
+        m_wakePending.store( false, std::memory_order_release );
+        bool emitted = false;
+        for( ;; )
+        {
+            LogSlot& slot = m_slots[m_dequeue & ( kSlots - 1 )];
+            if( slot.sequence.load( std::memory_order_acquire ) != m_dequeue + 1 )
+                break;
+            emit( callback, slot.text, slot.length, slot.color );
+            slot.sequence.store( m_dequeue + kSlots, std::memory_order_release );
+            m_dequeue++;
+            emitted = true;
+        }
+
+        const size_t dropped = m_dropped.exchange( 0, std::memory_order_relaxed );
+        if( dropped > 0 )
+        {
+            char text[64];
+            const int length = snprintf( text, sizeof( text ), "%zu log messages dropped", dropped );
+            emit( callback, text, length, Color::Yellow );
+            emitted = true;
+        }
+        return emitted && !callback;
+    }
+
+    // sleep until messages were pushed
+    void waitForMessages()
+    {
+        std::unique_lock<std::mutex> lock( m_wakeMutex );
+        m_wake.wait( lock, [this]() { return m_wakePending.load( std::memory_order_acquire ); } );
+    }
+
+private:
+    static void emit( FuncCallBack callback, const char* text, int length, Color color )
+    {
+        if( callback )
+        {
+            callback( text, int( color ), length );
+        }
+        else
+        {
+            fwrite( text, 1, size_t( length ), stdout );
+            fputc( '\n', stdout );
+        }
+    }
+
+    LogSlot                 m_slots[kSlots];
+    std::atomic<size_t>     m_enqueue{ 0 };
+    size_t                  m_dequeue = 0;
+    std::atomic<size_t>     m_dropped{ 0 };
+    std::mutex              m_drainMutex;
+
+    std::atomic<bool>       m_wakePending{ false };
+    std::mutex              m_wakeMutex;
+    std::condition_variable m_wake;
+};
+
+struct Logger
+{
+    LogRing                   ring;
+    std::atomic<FuncCallBack> callback{ nullptr };
+    std::atomic<int>          level{ int( LogLevel::Debug ) };
+    std::once_flag            flusherStarted;
+};
+
+// Never destroyed: the detached flush thread may still run while static objects are torn down
+// at exit, and the library may be unloaded without a chance to join it.
+static Logger& logger()
+{
+    static Logger* s_logger = new Logger();
+    return *s_logger;
+}
+
+static void startFlusher( Logger& log )
+{
+    std::call_once( log.flusherStarted, [&log]() {
+        std::thread( [&log]() {
+            for( ;; )
+            {
+                log.ring.waitForMessages();
+                if( log.ring.drain( log.callback.load( std::memory_order_acquire ) ) )
+                    fflush( stdout );
+            }
+        } ).detach();
+    } );
+}
+
+void Debug::Logf(LogLevel level, Color color, const char* format, ...)
+{
+    Logger& log = logger();
+    if( int( level ) < log.level.load( std::memory_order_relaxed ) )
+        return;
+    startFlusher( log );
+
+    va_list args;
+    va_start( args, format );
+    log.ring.push( level, color, format, args );
+    va_end( args );
+}
+
+void Debug::SetLevel(LogLevel level)
+{
+    logger().level.store( int( level ), std::memory_order_relaxed );
+}
+
+void Debug::Flush()
+{
+    Logger& log = logger();
+    if( log.ring.drain( log.callback.load( std::memory_order_acquire ) ) )
+        fflush( stdout );
+}
+
+void Debug::SetCallback(FuncCallBack callback)
+{
+    logger().callback.store( callback, std::memory_order_release );
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "optix_denoiser_wrapper.h"
+
+//Color Enum
+enum class Color { Red, Green, Blue, Black, White, Yellow, Orange };
+
+// severity of a log message, values as OPTIX_DENOISER_LOG_*
+enum class LogLevel { Debug = 0, Info = 1, Warning = 2, Error = 3, None = 4 };
+
+// Messages below this level are compiled out of the LOG_* macros. Override it for the build,
+// e.g. -DOPTIX_DENOISER_LOG_LEVEL=0 to keep the per-frame debug messages.
+#ifndef OPTIX_DENOISER_LOG_LEVEL
+#define OPTIX_DENOISER_LOG_LEVEL OPTIX_DENOISER_LOG_INFO
+#endif
+
+// Log messages are formatted into a preallocated lock-free ring and passed on to the
+// RegisterDebugCallback callback (stdout without one) by a background thread, so logging
+// never allocates, blocks or calls the callback on the logging thread. When the ring is full
+// messages are dropped and counted instead.
+class  Debug
+{
+public:
+    // printf style; messages longer than a ring slot are truncated
+    static void Logf(LogLevel level, Color color, const char* format, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+        ;
+
+    // messages below level are dropped at run time as well (default: everything compiled in)
+    static void SetLevel(LogLevel level);
+
+    // pass all queued messages on before returning
+    static void Flush();
+
+    static void SetCallback(FuncCallBack callback);
+};
+
+#define DEBUG_LOG( level, color, ... )                                         \
+    do                                                                         \
+    {                                                                          \
+        if( int( level ) >= OPTIX_DENOISER_LOG_LEVEL )                         \
+            Debug::Logf( level, color, __VA_ARGS__ );                          \
+    } while( 0 )
+
+#define LOG_DEBUG( ... )   DEBUG_LOG( LogLevel::Debug, Color::Black, __VA_ARGS__ )
+#define LOG_INFO( ... )    DEBUG_LOG( LogLevel::Info, Color::Black, __VA_ARGS__ )
+#define LOG_WARNING( ... ) DEBUG_LOG( LogLevel::Warning, Color::Yellow, __VA_ARGS__ )
+#define LOG_ERROR( ... )   DEBUG_LOG( LogLevel::Error, Color::Red, __VA_ARGS__ )
+
+#define SUTIL_ASSERT( cond )                                                   \
+    do                                                                         \
+    {                                                                          \
+        if( !(cond) )                                                          \
+            LOG_ERROR( ": %s (%d): %s", __FILE__, __LINE__, #cond );           \
+    } while( 0 )
+
+#define SUTIL_ASSERT_MSG( cond, msg )                                          \
+    do                                                                         \
+    {                                                                          \
+        if( !(cond) )                                                          \
+            LOG_ERROR( ": %s (%d): %s: %s", __FILE__, __LINE__, #cond, msg );  \
+    } while( 0 )
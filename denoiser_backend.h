@@ -0,0 +1,349 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "stage_timings.h"
+
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+#include <cuda_runtime.h>
+#else
+// layout compatible stand-in for the CUDA vector type, so host code builds without the toolkit
+struct float4 { float x, y, z, w; };
+#endif
+
+// Pixel layouts accepted for images; RGB formats carry no alpha.
+enum class DenoiserPixelFormat { Float4, Float3, Half4, Half3 };
+
+inline unsigned int pixelSizeInBytes( DenoiserPixelFormat format )
+{
+    switch( format )
+    {
+    case DenoiserPixelFormat::Float3: return 3 * sizeof( float );
+    case DenoiserPixelFormat::Half4:  return 4 * sizeof( uint16_t );
+    case DenoiserPixelFormat::Half3:  return 3 * sizeof( uint16_t );
+    default:                          return 4 * sizeof( float );
+    }
+}
+
+// Placement of the denoised width x height region inside caller memory, e.g. a sub-rectangle
+// of a larger framebuffer or a texture with padded rows.
+struct DenoiserImageLayout
+{
+    uint32_t  rowPitch = 0;     // distance between rows in pixels, 0 for rows of originX + width
+    uint32_t  originX  = 0;     // first pixel of the region
+    uint32_t  originY  = 0;
+
+    size_t rowStrideInBytes( uint32_t width, DenoiserPixelFormat format ) const
+    {
+        return size_t( rowPitch ? rowPitch : originX + width ) * pixelSizeInBytes( format );
+    }
+
+    float* regionStart( float* image, uint32_t width, DenoiserPixelFormat format ) const
+    {
+        if( !image )
+            return image;
+        const size_t offset = originY * rowStrideInBytes( width, format ) + size_t( originX ) * pixelSizeInBytes( format );
+        return reinterpret_cast<float*>( reinterpret_cast<char*>( image ) + offset );
+    }
+};
+
+// Host side description of the images handed to a denoiser backend. All images are
+// width*height pixels in the format given for their kind (the flow image is always float4),
+// placed in memory as described by the layout for their kind.
+struct DenoiserData
+{
+    uint32_t  width    = 0;
+    uint32_t  height   = 0;
+    float*    color    = nullptr;
+    float*    albedo   = nullptr;
+    float*    normal   = nullptr;
+    float*    flow     = nullptr;
+    std::vector< float* > aovs;     // input AOVs
+    std::vector< float* > outputs;  // denoised beauty, followed by denoised AOVs
+
+    // The image is caller owned device memory of the backend's device. The backend reads and
+    // writes it in place instead of copying through its own buffers. Host memory otherwise;
+    // the CPU backend has no device and treats every pointer as host memory.
+    bool      colorOnDevice  = false;
+    bool      albedoOnDevice = false;
+    bool      normalOnDevice = false;
+    bool      outputOnDevice = false;   // outputs[0]
+
+    DenoiserPixelFormat inputFormat  = DenoiserPixelFormat::Float4;  // color and AOVs
+    DenoiserPixelFormat guideFormat  = DenoiserPixelFormat::Float4;  // albedo and normal
+    DenoiserPixelFormat outputFormat = DenoiserPixelFormat::Float4;  // all outputs
+
+    DenoiserImageLayout inputLayout;    // color, AOVs, guides and flow
+    DenoiserImageLayout outputLayout;   // all outputs
+
+    void clear()
+    {
+        width = 0;
+        height = 0;
+        color = nullptr;
+        albedo = nullptr;
+        normal = nullptr;
+        flow = nullptr;
+        aovs.clear();
+        outputs.clear();
+        colorOnDevice  = false;
+        albedoOnDevice = false;
+        normalOnDevice = false;
+        outputOnDevice = false;
+        inputFormat    = DenoiserPixelFormat::Float4;
+        guideFormat    = DenoiserPixelFormat::Float4;
+        outputFormat   = DenoiserPixelFormat::Float4;
+        inputLayout    = DenoiserImageLayout();
+        outputLayout   = DenoiserImageLayout();
+    }
+};
+
+// How the model normalizes the color input. Backends derive it from the input of every exec
+// unless a fixed exposure is set, e.g. so that the row bands of one image denoised on several
+// devices share the exposure of the whole image (see computeImageExposure).
+struct DenoiserExposure
+{
+    float intensity       = 1.0f;                   // scale mapping the log-average luminance to middle grey
+    float averageColor[3] = { 0.f, 0.f, 0.f };      // log-average of each channel, for AOV and kernel prediction models
+};
+
+// Why init cannot run on data with the given tile size, or nullptr if it can
+inline const char* invalidInitReason( const DenoiserData& data, unsigned int tileWidth, unsigned int tileHeight )
+{
+    if( !data.color )
+        return "no color input";
+    if( data.width == 0 || data.height == 0 )
+        return "empty image";
+    if( data.outputs.empty() || !data.outputs[0] )
+        return "no output";
+    for( size_t i=0; i < data.aovs.size(); i++ )
+    {
+        if( !data.aovs[i] )
+            return "AOV without data";
+    }
+    if( data.normal && !data.albedo )
+        return "albedo is required if normal input is given";
+    if( ( tileWidth == 0 ) != ( tileHeight == 0 ) )
+        return "tile size must be > 0 for width and height";
+    if( data.inputLayout.rowPitch && data.inputLayout.rowPitch < data.inputLayout.originX + data.width )
+        return "input row pitch smaller than the image";
+    if( data.outputLayout.rowPitch && data.outputLayout.rowPitch < data.outputLayout.originX + data.width )
+        return "output row pitch smaller than the image";
+    return nullptr;
+}
+
+// The shape of an init call without its image data: what the memory a backend allocates
+// depends on.
+class DenoiserModel;
+
+struct DenoiserConfig
+{
+    uint32_t     width          = 0;
+    uint32_t     height         = 0;
+    bool         albedo         = false;
+    bool         normal         = false;
+    size_t       aovs           = 0;
+    bool         colorOnDevice  = false;    // caller owned images need no backend buffer
+    bool         albedoOnDevice = false;
+    bool         normalOnDevice = false;
+    bool         outputOnDevice = false;
+    DenoiserPixelFormat inputFormat  = DenoiserPixelFormat::Float4;
+    DenoiserPixelFormat guideFormat  = DenoiserPixelFormat::Float4;
+    DenoiserPixelFormat outputFormat = DenoiserPixelFormat::Float4;
+    unsigned int tileWidth      = 0;        // as passed to init, 0 for untiled or automatic
+    unsigned int tileHeight     = 0;
+    bool         kpMode         = false;
+    bool         temporalMode   = false;
+
+    DenoiserConfig() {}
+
+    DenoiserConfig( const DenoiserData& data, unsigned int tileWidth_ = 0, unsigned int tileHeight_ = 0,
+                    bool kpMode_ = false, bool temporalMode_ = false )
+        : width( data.width )
+        , height( data.height )
+        , albedo( data.albedo != nullptr )
+        , normal( data.normal != nullptr )
+        , aovs( data.aovs.size() )
+        , colorOnDevice( data.colorOnDevice )
+        , albedoOnDevice( data.albedoOnDevice )
+        , normalOnDevice( data.normalOnDevice )
+        , outputOnDevice( data.outputOnDevice )
+        , inputFormat( data.inputFormat )
+        , guideFormat( data.guideFormat )
+        , outputFormat( data.outputFormat )
+        , tileWidth( tileWidth_ )
+        , tileHeight( tileHeight_ )
+        , kpMode( kpMode_ )
+        , temporalMode( temporalMode_ )
+    {
+    }
+};
+
+// Memory a configuration needs, in bytes. The working set (images, scratch and state) is device
+// memory on the OptiX backend and host memory on the CPU backend.
+struct DenoiserMemoryRequirements
+{
+    size_t       inputs     = 0;    // color and AOV inputs
+    size_t       outputs    = 0;    // denoised beauty and AOVs
+    size_t       guides     = 0;    // albedo and normal
+    size_t       flow       = 0;    // temporal mode only
+    size_t       scratch    = 0;    // denoiser scratch, plus the temporal history on the CPU
+    size_t       state      = 0;    // denoiser state
+    size_t       model      = 0;    // denoiser weights, held by OptiX outside the working set
+    size_t       host       = 0;    // host memory besides the working set, e.g. staging buffers
+    bool         onDevice   = false;
+    unsigned int tileWidth  = 0;    // tiling init would use, 0 if untiled
+    unsigned int tileHeight = 0;
+    unsigned int overlap    = 0;    // pixels added on each side of a tile
+    unsigned int regionOverlap = 0; // pixels execRegion reads on each side of its rectangle
+
+    size_t workingSet() const { return inputs + outputs + guides + flow + scratch + state; }
+    size_t deviceTotal() const { return onDevice ? workingSet() + model : 0; }
+    size_t hostTotal() const { return host + ( onDevice ? 0 : workingSet() ); }
+};
+
+// Allocation size for an image dimension. Rounded up so that small resizes (e.g. dragging a
+// viewport edge) still fit into the existing buffers: the granularity is a quarter of the
+// largest power of two not above size, but at least 64 pixels.
+inline unsigned int bucketImageDimension( unsigned int size )
+{
+    unsigned int pow2 = 1;
+    while( pow2 <= size / 2 )
+        pow2 *= 2;
+    const unsigned int step = pow2 / 4 > 64 ? pow2 / 4 : 64;
+    return ( size + step - 1 ) / step * step;
+}
+
+enum class DenoiserBackendKind { Auto, OptiX, CPU };
+
+// Common lifecycle of all denoiser implementations: init once per session, then
+// update/exec/getResults per frame, finish when done.
+class DenoiserBackend
+{
+public:
+    typedef DenoiserData Data;
+
+    virtual ~DenoiserBackend() {}
+
+    // Initialize the backend and push all data to its working memory -- normaly done only once per session
+    // tileWidth, tileHeight: if nonzero, enable tiling with given dimension
+    // kpMode: if enabled, use kernel prediction model even if no AOVs are given
+    // temporalMode: if enabled, use a model for denoising sequences of images
+    // Returns false, logging why, if data cannot be denoised (see invalidInitReason); the
+    // backend must then be initialized again before it is used.
+    virtual bool init( const Data&  data,
+                       unsigned int tileWidth = 0,
+                       unsigned int tileHeight = 0,
+                       bool         kpMode = false,
+                       bool         temporalMode = false ) = 0;
+
+    // Memory init( config ) would allocate, computed without allocating any buffers. The OptiX
+    // backend needs a denoiser to ask for the sizes: it creates its device context on first use
+    // and, if the configuration's denoiser is neither current nor cached, a temporary one.
+    // Pipelined frames (submitFrame) add buffers per slot on top.
+    virtual DenoiserMemoryRequirements queryMemoryRequirements( const DenoiserConfig& config ) = 0;
+
+    // Execute the denoiser. In interactive sessions, this would be done once per frame/subframe
+    virtual void exec() = 0;
+
+    // Start exec() without waiting for it. Returns a ticket for poll/wait; tickets complete in
+    // submission order. getResults() and update() are ordered after all submitted work.
+    virtual uint64_t execAsync() = 0;
+
+    // true once the work of ticket (and every earlier one) has completed
+    virtual bool poll( uint64_t ticket ) = 0;
+
+    // block until the work of ticket (and every earlier one) has completed
+    virtual void wait( uint64_t ticket ) = 0;
+
+    // Denoise only the width x height rectangle at (x, y) of the image set up by init: the inputs
+    // of data are refreshed for the rectangle plus the overlap the model needs, and the result is
+    // merged into the outputs of data directly (no getResults needed). Outside the rectangle the
+    // outputs keep their previous result. Not available in temporal mode.
+    virtual void execRegion( const Data& data, unsigned int x, unsigned int y, unsigned int width, unsigned int height ) = 0;
+
+    // Update denoiser input data from host memory. Logs and does nothing if data does not match
+    // the size and layers of the last init.
+    virtual void update( const Data& data ) = 0;
+
+    // Copy results to host memory
+    virtual void getResults() = 0;
+
+    // Cleanup state, deallocate memory -- normally done only once per render session
+    virtual void finish() = 0;
+
+    // --- test flow vectors: flow is applied to noisy input image and written back to result
+    // --- no denoising.
+    virtual void getFlowResults() = 0;
+
+    // Normalize the input with exposure instead of deriving it from the color input in exec and
+    // execRegion; nullptr to derive it again. Kept across init, cleared by finish.
+    virtual void setExposure( const DenoiserExposure* exposure ) = 0;
+
+    // stage transfers of pageable host memory through page-locked buffers; backends that
+    // do not transfer to a device ignore this
+    virtual void setHostStaging( bool /*enabled*/ ) {}
+
+    // Device memory init may use for its image buffers, scratch and state, 0 for no limit. When
+    // init is called without a tile size, the backend then picks tiles that fit. Backends
+    // without device memory ignore this.
+    virtual void setMemoryBudget( size_t /*bytes*/ ) {}
+
+    // Denoise with a user trained model instead of the built-in ones, nullptr for the built-in
+    // models. Takes effect on init. Backends that cannot run trained models ignore this.
+    virtual void setUserModel( const std::shared_ptr<const DenoiserModel>& /*model*/ ) {}
+
+    // --- pipelined frames: up to depth frames are in flight at once, so the transfers of one
+    // --- frame overlap the denoising of another. Frames use the configuration of the last init.
+
+    // number of frame slots, clamped to 1..3 (default 2)
+    virtual void setPipelineDepth( unsigned int depth ) = 0;
+
+    // Copy the inputs of data into a free slot and queue its denoise. Blocks only while all slots
+    // are in flight. Returns a frame id, or 0 if the backend is not initialized for data.
+    virtual uint64_t submitFrame( const Data& data ) = 0;
+
+    // true once the frame has been denoised and its results are readable; false for frame 0
+    virtual bool pollFrame( uint64_t frame ) = 0;
+
+    // Wait for frame and return its denoised layer (0 = beauty, then AOVs): width*height tightly
+    // packed pixels in the outputFormat given to init, pixelSizeInBytes( outputFormat ) bytes
+    // each, owned by the backend. Valid until the slot is reused depth submissions later or
+    // init is called again; nullptr if it already was.
+    virtual const float* frameResult( uint64_t frame, size_t layer ) = 0;
+
+    // Durations of the stages of recent update/exec/getResults frames; pipelined frames and
+    // region passes are not timed. Device stages are collected once their work has completed.
+    virtual StageStatistics stageStatistics( DenoiserStage stage ) = 0;
+    virtual void            resetStageTimings() = 0;
+
+    virtual DenoiserBackendKind kind() const = 0;
+    virtual const char*         name() const = 0;
+};
+
+// Auto picks OptiX when it is compiled in and a device is present, CPU otherwise.
+// Returns nullptr if an explicitly requested backend is unavailable.
+std::unique_ptr<DenoiserBackend> createDenoiserBackend( DenoiserBackendKind kind );
+
+// Host memory suited for transfers to the active backend: page-locked when the OptiX backend is
+// available, plain heap memory otherwise. Release with freeHostMemory.
+void* allocHostMemory( size_t bytes );
+void  freeHostMemory( void* ptr );
+
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+void* allocPinnedHostMemory( size_t bytes );
+void  freePinnedHostMemory( void* ptr );
+
+// Give the cached device memory of finished sessions back to CUDA. Denoiser buffers are
+// sub-allocated from per device slabs that otherwise stay allocated for the next session.
+void                             trimDeviceMemory();
+
+// true if a CUDA device is present and the OptiX entry points could be loaded
+bool                             isOptiXDenoiserAvailable();
+// number of CUDA devices the OptiX backend can run on, 0 if it is unavailable
+unsigned int                     optiXDeviceCount();
+// device: CUDA device ordinal to bind the denoiser to, -1 for the current device of each call
+std::unique_ptr<DenoiserBackend> createOptiXDenoiser( int device = -1 );
+#endif
+std::unique_ptr<DenoiserBackend> createCPUDenoiser();
@@ -0,0 +1,325 @@
+#include "denoiser_device_pool.h"
+#include "debug.h"
+#include "pixel_format.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <tuple>
+
+DeviceScheduler::DeviceScheduler( size_t deviceCount )
+    : m_devices( deviceCount )
+{
+}
+
+double DeviceScheduler::estimatedThroughput( size_t device ) const
+{
+    if( m_devices[device].pixelsPerSecond > 0.0 )
+        return m_devices[device].pixelsPerSecond;
+    double sum      = 0.0;
+    size_t measured = 0;
+    for( const Device& d : m_devices )
+    {
+        if( d.pixelsPerSecond > 0.0 )
+        {
+            sum += d.pixelsPerSecond;
+            measured++;
+        }
+    }
+    return measured ? sum / double( measured ) : 1.0;
+}
+
+size_t DeviceScheduler::assign( uint64_t pixels )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    size_t best       = 0;
+    double bestFinish = 0.0;
+    for( size_t i=0; i < m_devices.size(); i++ )
+    {
+        const double finish = double( m_devices[i].pending + pixels ) / estimatedThroughput( i );
+        if( i == 0 || finish < bestFinish )
+        {
+            best       = i;
+            bestFinish = finish;
+        }
+    }
+    m_devices[best].pending += pixels;
+    return best;
+}
+
+void DeviceScheduler::assign( size_t device, uint64_t pixels )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_devices[device].pending += pixels;
+}
+
+void DeviceScheduler::complete( size_t device, uint64_t pixels, double seconds )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    Device& d = m_devices[device];
+    d.pending   -= std::min( d.pending, pixels );
+    d.completed += pixels;
+    if( seconds <= 0.0 || pixels == 0 )
+        return;
+    // smoothed, so a single slow frame (e.g. one that rebuilt the denoiser) does not swing the split
+    const double rate = double( pixels ) / seconds;
+    d.pixelsPerSecond = d.pixelsPerSecond > 0.0 ? 0.7 * d.pixelsPerSecond + 0.3 * rate : rate;
+}
+
+std::vector< unsigned int > DeviceScheduler::partition( unsigned int rows, unsigned int granularity ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    granularity = std::max( granularity, 1u );
+
+    std::vector< double > weights( m_devices.size() );
+    double total = 0.0;
+    for( size_t i=0; i < m_devices.size(); i++ )
+    {
+        weights[i] = estimatedThroughput( i );
+        total += weights[i];
+    }
+
+    // place the band boundaries at the rounded cumulative shares, the last one at rows
+    std::vector< unsigned int > bands( m_devices.size(), 0 );
+    double       cumulative = 0.0;
+    unsigned int begin      = 0;
+    for( size_t i=0; i < m_devices.size(); i++ )
+    {
+        cumulative += weights[i];
+        unsigned int end = rows;
+        if( i + 1 < m_devices.size() )
+        {
+            const double boundary = double( rows ) * cumulative / total / granularity;
+            end = std::min( rows, std::max( begin, unsigned( boundary + 0.5 ) * granularity ) );
+        }
+        bands[i] = end - begin;
+        begin    = end;
+    }
+    return bands;
+}
+
+double DeviceScheduler::throughput( size_t device ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return estimatedThroughput( device );
+}
+
+uint64_t DeviceScheduler::pending( size_t device ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_devices[device].pending;
+}
+
+uint64_t DeviceScheduler::completed( size_t device ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_devices[device].completed;
+}
+
+typedef std::chrono::steady_clock PoolClock;
+
+static double secondsSince( PoolClock::time_point start )
+{
+    return std::chrono::duration<double>( PoolClock::now() - start ).count();
+}
+
+// call fn( device ) on one thread per device and wait for all of them
+template< typename Fn >
+static void runOnDevices( size_t deviceCount, const Fn& fn )
+{
+    std::vector< std::thread > threads;
+    for( size_t i=1; i < deviceCount; i++ )
+        threads.emplace_back( fn, i );
+    if( deviceCount > 0 )
+        fn( size_t( 0 ) );
+    for( std::thread& t : threads )
+        t.join();
+}
+
+static bool isComplete( const DenoiserData& image )
+{
+    return image.color && !image.outputs.empty() && image.outputs[0] && image.width && image.height
+           && ( !image.normal || image.albedo );
+}
+
+// images with equal keys share one denoiser setup
+typedef std::tuple< uint32_t, uint32_t, bool, bool, size_t > ImageShape;
+
+static ImageShape imageShape( const DenoiserData& image )
+{
+    return ImageShape( image.width, image.height, image.albedo != nullptr, image.normal != nullptr, image.aovs.size() );
+}
+
+DenoiserDevicePool::DenoiserDevicePool( size_t deviceCount, const DenoiserFactory& factory )
+    : m_scheduler( deviceCount )
+    , m_bandOutputs( deviceCount )
+{
+    for( size_t i=0; i < deviceCount; i++ )
+        m_devices.push_back( factory( i ) );
+}
+
+DenoiserDevicePool::~DenoiserDevicePool()
+{
+    for( std::unique_ptr<DenoiserBackend>& device : m_devices )
+        device->finish();
+}
+
+size_t DenoiserDevicePool::denoiseImages( const std::vector< DenoiserData >& images )
+{
+    // largest first, so that the small images at the end even out the devices' finish times;
+    // equal shapes end up next to each other and mostly reuse one setup per device
+    std::vector< size_t > order;
+    for( size_t i=0; i < images.size(); i++ )
+    {
+        if( isComplete( images[i] ) )
+            order.push_back( i );
+    }
+    std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) {
+        const uint64_t pixelsA = uint64_t( images[a].width ) * images[a].height;
+        const uint64_t pixelsB = uint64_t( images[b].width ) * images[b].height;
+        if( pixelsA != pixelsB )
+            return pixelsA > pixelsB;
+        return imageShape( images[a] ) < imageShape( images[b] );
+    } );
+
+    std::vector< std::vector< size_t > > queues( m_devices.size() );
+    for( size_t i : order )
+        queues[m_scheduler.assign( uint64_t( images[i].width ) * images[i].height )].push_back( i );
+
+    std::atomic<size_t> denoised( 0 );
+    runOnDevices( m_devices.size(), [&]( size_t device ) {
+        DenoiserBackend& backend = *m_devices[device];
+        bool             initialized = false;
+        ImageShape       shape;
+        for( size_t i : queues[device] )
+        {
+            const DenoiserData& image  = images[i];
+            const uint64_t      pixels = uint64_t( image.width ) * image.height;
+            const PoolClock::time_point start = PoolClock::now();
+            if( !initialized || imageShape( image ) != shape )
+            {
+                shape       = imageShape( image );
+                initialized = backend.init( image );
+                if( !initialized )
+                {
+                    m_scheduler.complete( device, pixels, 0.0 );
+                    continue;
+                }
+            }
+            else
+            {
+                backend.update( image );
+            }
+            backend.exec();
+            backend.getResults();
+            m_scheduler.complete( device, pixels, secondsSince( start ) );
+            denoised++;
+        }
+    } );
+    return denoised;
+}
+
+bool DenoiserDevicePool::denoiseSharded( const DenoiserData& image )
+{
+    if( !isComplete( image ) )
+        return false;
+    if( image.colorOnDevice || image.albedoOnDevice || image.normalOnDevice || image.outputOnDevice )
+    {
+        LOG_ERROR( "Sharded denoising needs host images" );
+        return false;
+    }
+
+    // one exposure for the whole image, so that the bands join without seams
+    const DenoiserExposure exposure = computeImageExposure( image.inputLayout.regionStart( image.color, image.width, image.inputFormat ),
+                                                            image.inputLayout.rowStrideInBytes( image.width, image.inputFormat ),
+                                                            image.inputFormat, image.width, image.height );
+    // rows a band reads beyond its own; the model is the same on every device
+    const unsigned int margin = m_devices[0]->queryMemoryRequirements( DenoiserConfig( image ) ).regionOverlap;
+
+    // bands in multiples of 16 rows keep the per-band overlap small relative to the band
+    const std::vector< unsigned int > bands = m_scheduler.partition( image.height, 16 );
+    std::vector< unsigned int > firstRow( bands.size(), 0 );
+    for( size_t i=1; i < bands.size(); i++ )
+        firstRow[i] = firstRow[i-1] + bands[i-1];
+    for( size_t i=0; i < bands.size(); i++ )
+        m_scheduler.assign( i, uint64_t( image.width ) * bands[i] );
+
+    const size_t out_pitch = image.outputLayout.rowStrideInBytes( image.width, image.outputFormat );
+    const size_t row_bytes = size_t( image.width ) * pixelSizeInBytes( image.outputFormat );
+
+    std::atomic<bool> failed( false );
+    runOnDevices( m_devices.size(), [&]( size_t device ) {
+        if( bands[device] == 0 )
+            return;
+        DenoiserBackend&   backend = *m_devices[device];
+        const uint64_t     pixels  = uint64_t( image.width ) * bands[device];
+        const unsigned int top     = firstRow[device] > margin ? firstRow[device] - margin : 0;
+        const unsigned int bottom  = std::min( firstRow[device] + bands[device] + margin, image.height );
+
+        // The device only sees the rows of its window, the band plus the margin: inputs are read
+        // in place through the layout origin, and the window is denoised into the device's own
+        // buffers, of which only the band is copied to the outputs.
+        DenoiserData window = image;
+        window.height = bottom - top;
+        window.inputLayout.originY += top;
+        window.outputLayout = DenoiserImageLayout();
+        std::vector< std::vector< float > >& buffers = m_bandOutputs[device];
+        buffers.resize( image.outputs.size() );
+        for( size_t i=0; i < image.outputs.size(); i++ )
+        {
+            buffers[i].resize( ( row_bytes * window.height + sizeof( float ) - 1 ) / sizeof( float ) );
+            window.outputs[i] = image.outputs[i] ? buffers[i].data() : nullptr;
+        }
+
+        // the sample covers the upload and download as well, which scale with the band too
+        const PoolClock::time_point start = PoolClock::now();
+        backend.setExposure( &exposure );
+        const bool initialized = backend.init( window );
+        if( initialized )
+        {
+            backend.exec();
+            backend.getResults();
+            const unsigned int skip = firstRow[device] - top;
+            for( size_t i=0; i < image.outputs.size(); i++ )
+            {
+                if( !image.outputs[i] )
+                    continue;
+                char* dst = reinterpret_cast<char*>( image.outputLayout.regionStart( image.outputs[i], image.width, image.outputFormat ) );
+                copyImageRows( dst + size_t( firstRow[device] ) * out_pitch, out_pitch,
+                               reinterpret_cast<const char*>( buffers[i].data() ) + size_t( skip ) * row_bytes, row_bytes,
+                               row_bytes, bands[device] );
+            }
+        }
+        backend.setExposure( nullptr );
+        m_scheduler.complete( device, pixels, initialized ? secondsSince( start ) : 0.0 );
+        if( !initialized )
+            failed = true;
+    } );
+    return !failed;
+}
+
+std::unique_ptr<DenoiserDevicePool> createDenoiserDevicePool( DenoiserBackendKind kind, unsigned int deviceCount )
+{
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+    if( kind != DenoiserBackendKind::CPU )
+    {
+        unsigned int devices = optiXDeviceCount();
+        if( devices > 0 )
+        {
+            if( deviceCount > 0 )
+                devices = std::min( devices, deviceCount );
+            return std::unique_ptr<DenoiserDevicePool>( new DenoiserDevicePool(
+                devices, []( size_t device ) { return createOptiXDenoiser( int( device ) ); } ) );
+        }
+    }
+#endif
+    if( kind == DenoiserBackendKind::OptiX )
+    {
+        LOG_ERROR( "OptiX backend is not available" );
+        return nullptr;
+    }
+    return std::unique_ptr<DenoiserDevicePool>( new DenoiserDevicePool(
+        std::max( deviceCount, 1u ), []( size_t ) { return createCPUDenoiser(); } ) );
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "denoiser_backend.h"
+
+#include <functional>
+#include <mutex>
+
+// Load bookkeeping for devices of unequal speed. A device's throughput (pixels per second) is
+// learned from the work it completed; devices without measurements are assumed to be as fast
+// as the average measured device, so identical devices start out evenly loaded.
+class DeviceScheduler
+{
+public:
+    explicit DeviceScheduler( size_t deviceCount );
+
+    size_t deviceCount() const { return m_devices.size(); }
+
+    // Assign pixels of work to the device predicted to finish it first, given the work that is
+    // already assigned and not yet completed. Returns that device.
+    size_t assign( uint64_t pixels );
+
+    // assign pixels of work to the given device
+    void assign( size_t device, uint64_t pixels );
+
+    // Work assigned to device finished after seconds: release it and refine the throughput.
+    void complete( size_t device, uint64_t pixels, double seconds );
+
+    // Split rows into one contiguous band per device (in device order), sized in proportion to
+    // the device throughputs and rounded to multiples of granularity. Bands may be empty.
+    std::vector< unsigned int > partition( unsigned int rows, unsigned int granularity ) const;
+
+    double   throughput( size_t device ) const;   // estimated pixels per second
+    uint64_t pending( size_t device ) const;      // pixels assigned and not completed
+    uint64_t completed( size_t device ) const;    // pixels completed in total
+
+private:
+    struct Device
+    {
+        uint64_t pending         = 0;
+        uint64_t completed       = 0;
+        double   pixelsPerSecond = 0.0;   // 0 until measured
+    };
+
+    double estimatedThroughput( size_t device ) const;   // m_mutex held
+
+    mutable std::mutex    m_mutex;
+    std::vector< Device > m_devices;
+};
+
+typedef std::function< std::unique_ptr<DenoiserBackend>( size_t device ) > DenoiserFactory;
+
+// One denoiser backend per device, driven from one host thread per device. Work is either
+// spread as whole images (jobs) or, for a single large image, sharded into row bands.
+class DenoiserDevicePool
+{
+public:
+    // factory creates the backend of each device, e.g. an OptiX denoiser bound to that CUDA
+    // device, or a CPU denoiser standing in for a simulated device
+    DenoiserDevicePool( size_t deviceCount, const DenoiserFactory& factory );
+    ~DenoiserDevicePool();
+
+    size_t size() const { return m_devices.size(); }
+
+    // Denoise independent images, each on one device. Larger images are placed first, each on
+    // the device predicted to finish it first. Returns the number of images denoised.
+    size_t denoiseImages( const std::vector< DenoiserData >& images );
+
+    // Denoise one host image with its rows split among the devices in proportion to their
+    // speed. Each device uploads and sets up only its band plus the overlap the model reads
+    // around it; the exposure is computed once over the whole image and shared by all devices,
+    // so that the bands join without seams.
+    bool denoiseSharded( const DenoiserData& image );
+
+    const DeviceScheduler& scheduler() const { return m_scheduler; }
+
+private:
+    std::vector< std::unique_ptr<DenoiserBackend> > m_devices;
+    DeviceScheduler                                 m_scheduler;
+    std::vector< std::vector< std::vector< float > > > m_bandOutputs;   // per device and output: denoised window of denoiseSharded
+};
+
+// kind OptiX (or Auto with OptiX available): one device per CUDA device, up to deviceCount
+// (0 = all). kind CPU: deviceCount (at least 1) simulated devices running the CPU backend.
+// Returns nullptr if no device is available.
+std::unique_ptr<DenoiserDevicePool> createDenoiserDevicePool( DenoiserBackendKind kind, unsigned int deviceCount );
@@ -0,0 +1,213 @@
+#include "denoiser_model.h"
+#include "debug.h"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint64_t fnv1a( const void* data, size_t size )
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>( data );
+    uint64_t             hash  = 14695981039346656037ull;
+    for( size_t i=0; i < size; i++ )
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// identity, size and modification time (in the file system's finest resolution), to tell
+// whether a cached file changed on disk. A file replaced by rename gets a new identity even
+// if size and time happen to match.
+struct FileStamp
+{
+    uint64_t device   = 0;
+    uint64_t file     = 0;      // inode, or the NTFS file index
+    uint64_t size     = 0;
+    int64_t  modified = 0;      // nanoseconds on POSIX, 100 ns units on Windows
+
+    bool operator==( const FileStamp& other ) const
+    {
+        return device == other.device && file == other.file && size == other.size && modified == other.modified;
+    }
+};
+
+static bool fileStamp( const std::string& path, FileStamp& stamp )
+{
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA( path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if( handle == INVALID_HANDLE_VALUE )
+        return false;
+    BY_HANDLE_FILE_INFORMATION attributes;
+    const BOOL found = GetFileInformationByHandle( handle, &attributes );
+    CloseHandle( handle );
+    if( !found )
+        return false;
+    stamp.device   = attributes.dwVolumeSerialNumber;
+    stamp.file     = ( uint64_t( attributes.nFileIndexHigh ) << 32 ) | attributes.nFileIndexLow;
+    stamp.size     = ( uint64_t( attributes.nFileSizeHigh ) << 32 ) | attributes.nFileSizeLow;
+    stamp.modified = ( int64_t( attributes.ftLastWriteTime.dwHighDateTime ) << 32 ) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat attributes;
+    if( stat( path.c_str(), &attributes ) != 0 )
+        return false;
+#if defined(__APPLE__)
+    const struct timespec& modified = attributes.st_mtimespec;
+#else
+    const struct timespec& modified = attributes.st_mtim;
+#endif
+    stamp.device   = uint64_t( attributes.st_dev );
+    stamp.file     = uint64_t( attributes.st_ino );
+    stamp.size     = uint64_t( attributes.st_size );
+    stamp.modified = int64_t( modified.tv_sec ) * 1000000000 + modified.tv_nsec;
+#endif
+    return true;
+}
+
+DenoiserModel::~DenoiserModel()
+{
+#if defined(_WIN32)
+    if( m_data )
+        UnmapViewOfFile( m_data );
+    if( m_mapping )
+        CloseHandle( m_mapping );
+    if( m_file )
+        CloseHandle( m_file );
+#else
+    if( m_data )
+        munmap( const_cast<void*>( m_data ), m_size );
+#endif
+}
+
+bool DenoiserModel::map( const std::string& path )
+{
+    m_path = path;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if( file == INVALID_HANDLE_VALUE )
+        return false;
+    m_file = file;
+    LARGE_INTEGER size;
+    if( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 )
+        return false;
+    m_mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    if( !m_mapping )
+        return false;
+    m_data = MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 );
+    if( !m_data )
+        return false;
+    m_size = size_t( size.QuadPart );
+#else
+    const int file = open( path.c_str(), O_RDONLY );
+    if( file < 0 )
+        return false;
+    struct stat attributes;
+    if( fstat( file, &attributes ) != 0 || attributes.st_size == 0 )
+    {
+        close( file );
+        return false;
+    }
+    // The mapping keeps the file referenced, the descriptor is not needed any more. It does not
+    // keep the contents: MAP_PRIVATE only copies pages this process writes, so a file rewritten
+    // in place shows through (and a truncated one faults), see loadDenoiserModel.
+    void* data = mmap( nullptr, size_t( attributes.st_size ), PROT_READ, MAP_PRIVATE, file, 0 );
+    close( file );
+    if( data == MAP_FAILED )
+        return false;
+    m_data = data;
+    m_size = size_t( attributes.st_size );
+#endif
+    m_hash = fnv1a( m_data, m_size );
+    return true;
+}
+
+struct ModelCache
+{
+    struct Entry
+    {
+        std::shared_ptr<const DenoiserModel> model;
+        FileStamp                            stamp;
+    };
+
+    std::mutex                                                  mutex;
+    std::map< std::string, Entry >                              byPath;
+    std::multimap< uint64_t, std::weak_ptr<const DenoiserModel> > byHash;
+};
+
+static ModelCache& modelCache()
+{
+    static ModelCache s_cache;
+    return s_cache;
+}
+
+std::shared_ptr<const DenoiserModel> loadDenoiserModel( const std::string& path )
+{
+    ModelCache& cache = modelCache();
+    std::lock_guard<std::mutex> lock( cache.mutex );
+
+    FileStamp stamp;
+    if( !fileStamp( path, stamp ) )
+    {
+        LOG_ERROR( "Denoiser model not found:%s", path.c_str() );
+        return nullptr;
+    }
+    auto cached = cache.byPath.find( path );
+    if( cached != cache.byPath.end() && cached->second.stamp == stamp )
+        return cached->second.model;
+
+    std::shared_ptr<DenoiserModel> model( new DenoiserModel() );
+    if( !model->map( path ) )
+    {
+        LOG_ERROR( "Denoiser model could not be mapped:%s", path.c_str() );
+        return nullptr;
+    }
+
+    // a file with the same contents (e.g. a copy, or a rewrite that changed nothing) is
+    // already mapped: share that model and let this mapping go
+    std::shared_ptr<const DenoiserModel> result = model;
+    auto range = cache.byHash.equal_range( model->hash() );
+    for( auto it = range.first; it != range.second; )
+    {
+        std::shared_ptr<const DenoiserModel> known = it->second.lock();
+        if( !known )
+        {
+            it = cache.byHash.erase( it );
+            continue;
+        }
+        if( known->size() == model->size() && memcmp( known->data(), model->data(), model->size() ) == 0 )
+        {
+            result = known;
+            break;
+        }
+        ++it;
+    }
+    if( result == model )
+        cache.byHash.emplace( model->hash(), result );
+
+    ModelCache::Entry& entry = cache.byPath[path];
+    entry.model = result;
+    entry.stamp = stamp;
+    LOG_INFO( "Denoiser model loaded:%s (%zu bytes)", path.c_str(), result->size() );
+    return result;
+}
+
+void clearDenoiserModelCache()
+{
+    ModelCache& cache = modelCache();
+    std::lock_guard<std::mutex> lock( cache.mutex );
+    cache.byPath.clear();
+    cache.byHash.clear();
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+// A user trained denoiser model file, memory-mapped read-only. The bytes are handed to the
+// denoiser as they are in the file, without copying them into the heap.
+class DenoiserModel
+{
+public:
+    ~DenoiserModel();
+
+    const void*        data() const { return m_data; }
+    size_t             size() const { return m_size; }
+    uint64_t           hash() const { return m_hash; }    // FNV-1a of the contents
+    const std::string& path() const { return m_path; }
+
+private:
+    friend std::shared_ptr<const DenoiserModel> loadDenoiserModel( const std::string& path );
+
+    DenoiserModel() {}
+    DenoiserModel( const DenoiserModel& ) = delete;
+    DenoiserModel& operator=( const DenoiserModel& ) = delete;
+
+    bool map( const std::string& path );
+
+    const void* m_data   = nullptr;
+    size_t      m_size   = 0;
+    uint64_t    m_hash   = 0;
+    std::string m_path;
+#if defined(_WIN32)
+    void*       m_file    = nullptr;
+    void*       m_mapping = nullptr;
+#endif
+};
+
+// Load the model file at path, or return the model already loaded from it. Models are cached
+// process wide by path and by content hash: reloading an unchanged file (same file identity,
+// size and modification time) does not touch it again, and identical files share one mapping.
+// Returns nullptr if the file cannot be mapped.
+// The file stays mapped while the model is in use, so it must not be modified in place: replace
+// a model by writing a new file and renaming it over the old one. A rewrite in place changes
+// the bytes under denoisers that already consumed them, and truncating the file makes reads of
+// the mapping fault (SIGBUS).
+std::shared_ptr<const DenoiserModel> loadDenoiserModel( const std::string& path );
+
+// drop the cache's references; models still used by a denoiser stay mapped until released
+void clearDenoiserModelCache();
@@ -0,0 +1,276 @@
+// Device pool scheduling on simulated devices: CPU denoisers standing in for GPUs, one of them
+// artificially slowed down. Checks that sharded bands cover the image exactly, that images are
+// placed largest first, and that the split follows the measured throughput.
+#include "denoiser_device_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+static int g_failures = 0;
+
+#define CHECK( condition )                                                                  \
+    do                                                                                      \
+    {                                                                                       \
+        if( !( condition ) )                                                                \
+        {                                                                                   \
+            fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+            g_failures++;                                                                   \
+        }                                                                                   \
+    } while( 0 )
+
+// A CPU denoiser that records the images it is given and, if slowed down, takes at least
+// pixels / pixelsPerSecond seconds per exec
+class SimulatedDevice : public DenoiserBackend
+{
+public:
+    struct Call
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t originY;
+    };
+
+    explicit SimulatedDevice( double pixelsPerSecond )
+        : m_backend( createCPUDenoiser() )
+        , m_pixelsPerSecond( pixelsPerSecond )
+    {
+    }
+
+    const std::vector< Call >& calls() const { return m_calls; }
+
+    bool init( const Data& data, unsigned int tileWidth, unsigned int tileHeight, bool kpMode, bool temporalMode ) override
+    {
+        record( data );
+        return m_backend->init( data, tileWidth, tileHeight, kpMode, temporalMode );
+    }
+    void update( const Data& data ) override
+    {
+        record( data );
+        m_backend->update( data );
+    }
+    void exec() override
+    {
+        m_backend->exec();
+        if( m_pixelsPerSecond > 0.0 )
+            std::this_thread::sleep_for( std::chrono::duration<double>( double( m_pixels ) / m_pixelsPerSecond ) );
+    }
+
+    DenoiserMemoryRequirements queryMemoryRequirements( const DenoiserConfig& config ) override { return m_backend->queryMemoryRequirements( config ); }
+    uint64_t execAsync() override { return m_backend->execAsync(); }
+    bool     poll( uint64_t ticket ) override { return m_backend->poll( ticket ); }
+    void     wait( uint64_t ticket ) override { m_backend->wait( ticket ); }
+    void     execRegion( const Data& data, unsigned int x, unsigned int y, unsigned int width, unsigned int height ) override { m_backend->execRegion( data, x, y, width, height ); }
+    void     getResults() override { m_backend->getResults(); }
+    void     finish() override { m_backend->finish(); }
+    void     getFlowResults() override { m_backend->getFlowResults(); }
+    void     setExposure( const DenoiserExposure* exposure ) override { m_backend->setExposure( exposure ); }
+    void     setPipelineDepth( unsigned int depth ) override { m_backend->setPipelineDepth( depth ); }
+    uint64_t submitFrame( const Data& data ) override { return m_backend->submitFrame( data ); }
+    bool     pollFrame( uint64_t frame ) override { return m_backend->pollFrame( frame ); }
+    const float* frameResult( uint64_t frame, size_t layer ) override { return m_backend->frameResult( frame, layer ); }
+    StageStatistics stageStatistics( DenoiserStage stage ) override { return m_backend->stageStatistics( stage ); }
+    void     resetStageTimings() override { m_backend->resetStageTimings(); }
+
+    DenoiserBackendKind kind() const override { return DenoiserBackendKind::CPU; }
+    const char*         name() const override { return "Simulated"; }
+
+private:
+    void record( const Data& data )
+    {
+        Call call = { data.width, data.height, data.inputLayout.originY };
+        m_calls.push_back( call );
+        m_pixels = uint64_t( data.width ) * data.height;
+    }
+
+    std::unique_ptr<DenoiserBackend> m_backend;
+    double                           m_pixelsPerSecond;
+    uint64_t                         m_pixels = 0;
+    std::vector< Call >              m_calls;
+};
+
+// pool of count simulated devices; devices[i] is slowed down to speeds[i] pixels per second
+// if that is > 0
+static std::unique_ptr<DenoiserDevicePool> createPool( const std::vector< double >& speeds, std::vector< SimulatedDevice* >& devices )
+{
+    devices.clear();
+    return std::unique_ptr<DenoiserDevicePool>( new DenoiserDevicePool( speeds.size(), [&]( size_t device ) {
+        SimulatedDevice* simulated = new SimulatedDevice( speeds[device] );
+        devices.push_back( simulated );
+        return std::unique_ptr<DenoiserBackend>( simulated );
+    } ) );
+}
+
+struct TestImage
+{
+    std::vector< float > color;
+    std::vector< float > output;
+    DenoiserData         data;
+
+    TestImage( uint32_t width, uint32_t height, std::mt19937& rng )
+    {
+        std::normal_distribution<float> noise( 0.5f, 0.1f );
+        color.resize( size_t( width ) * height * 4 );
+        for( float& value : color )
+            value = noise( rng );
+        output.assign( color.size(), NAN );
+        data.width  = width;
+        data.height = height;
+        data.color  = color.data();
+        data.outputs.assign( 1, output.data() );
+    }
+};
+
+static void testPartition()
+{
+    DeviceScheduler scheduler( 3 );
+    scheduler.complete( 0, 1000, 1.0 );
+    scheduler.complete( 1, 3000, 1.0 );
+    scheduler.complete( 2, 500, 1.0 );
+
+    const unsigned int rows[] = { 0, 1, 15, 16, 100, 1000, 1080 };
+    for( unsigned int r : rows )
+    {
+        const std::vector< unsigned int > bands = scheduler.partition( r, 16 );
+        CHECK( bands.size() == 3 );
+        // contiguous bands whose boundaries are on the granularity, or at the last row
+        unsigned int end = 0;
+        for( size_t i=0; i < bands.size(); i++ )
+        {
+            end += bands[i];
+            CHECK( end % 16 == 0 || end == r );
+        }
+        CHECK( end == r );
+    }
+
+    // the fastest device gets the largest band
+    const std::vector< unsigned int > bands = scheduler.partition( 1000, 16 );
+    CHECK( bands[1] > bands[0] && bands[0] > bands[2] );
+}
+
+static void testShardedCoverage()
+{
+    std::mt19937 rng( 1 );
+    TestImage image( 96, 200, rng );
+
+    std::vector< SimulatedDevice* > devices;
+    std::unique_ptr<DenoiserDevicePool> pool = createPool( std::vector< double >( 3, 0.0 ), devices );
+    CHECK( pool->denoiseSharded( image.data ) );
+
+    // every pixel written once, and equal to denoising the whole image on one device
+    std::vector< float > reference( image.color.size() );
+    DenoiserData data = image.data;
+    data.outputs.assign( 1, reference.data() );
+    std::unique_ptr<DenoiserBackend> single = createCPUDenoiser();
+    CHECK( single->init( data ) );
+    single->exec();
+    single->getResults();
+    single->finish();
+    CHECK( image.output == reference );
+
+    // each device saw a window of rows, together covering the image
+    std::vector< int > seen( image.data.height, 0 );
+    for( SimulatedDevice* device : devices )
+    {
+        for( const SimulatedDevice::Call& call : device->calls() )
+        {
+            CHECK( call.width == image.data.width );
+            CHECK( call.height < image.data.height );
+            for( uint32_t y = call.originY; y < call.originY + call.height && y < image.data.height; y++ )
+                seen[y]++;
+        }
+    }
+    CHECK( std::find( seen.begin(), seen.end(), 0 ) == seen.end() );
+}
+
+static void testLargestFirst()
+{
+    std::mt19937 rng( 2 );
+    const uint32_t sizes[] = { 24, 64, 40, 16, 56, 32, 48, 24, 72, 16 };
+    std::vector< std::unique_ptr<TestImage> > images;
+    std::vector< DenoiserData > data;
+    for( uint32_t size : sizes )
+    {
+        images.emplace_back( new TestImage( size, size, rng ) );
+        data.push_back( images.back()->data );
+    }
+
+    std::vector< SimulatedDevice* > devices;
+    std::unique_ptr<DenoiserDevicePool> pool = createPool( std::vector< double >( 3, 0.0 ), devices );
+    CHECK( pool->denoiseImages( data ) == data.size() );
+
+    // each device works from large to small, and the three largest images start the devices
+    std::vector< uint32_t > firsts;
+    for( SimulatedDevice* device : devices )
+    {
+        const std::vector< SimulatedDevice::Call >& calls = device->calls();
+        CHECK( !calls.empty() );
+        for( size_t i=1; i < calls.size(); i++ )
+            CHECK( calls[i].width * calls[i].height <= calls[i-1].width * calls[i-1].height );
+        if( !calls.empty() )
+            firsts.push_back( calls[0].width );
+    }
+    std::sort( firsts.begin(), firsts.end() );
+    CHECK( firsts == std::vector< uint32_t >( { 56, 64, 72 } ) );
+
+    for( const std::unique_ptr<TestImage>& image : images )
+        CHECK( !std::isnan( image->output[0] ) );
+}
+
+static void testThroughputAdaptation()
+{
+    std::mt19937 rng( 3 );
+    TestImage image( 128, 256, rng );
+
+    // device 1 is limited to 20000 pixels per second, far below the CPU filter
+    std::vector< double > speeds( 3, 0.0 );
+    speeds[1] = 20000.0;
+    std::vector< SimulatedDevice* > devices;
+    std::unique_ptr<DenoiserDevicePool> pool = createPool( speeds, devices );
+
+    for( int i=0; i < 4; i++ )
+        CHECK( pool->denoiseSharded( image.data ) );
+
+    const DeviceScheduler& scheduler = pool->scheduler();
+    CHECK( scheduler.throughput( 1 ) < 0.5 * scheduler.throughput( 0 ) );
+    CHECK( scheduler.throughput( 1 ) < 0.5 * scheduler.throughput( 2 ) );
+
+    // the slow device's band shrank from the even first split, possibly to nothing
+    const std::vector< SimulatedDevice::Call >& calls = devices[1]->calls();
+    CHECK( !calls.empty() );
+    CHECK( calls.size() < 4 || calls.back().height < calls.front().height );
+    const std::vector< unsigned int > bands = scheduler.partition( image.data.height, 16 );
+    CHECK( bands[1] < bands[0] && bands[1] < bands[2] );
+
+    // whole images go to the fast devices too
+    std::vector< std::unique_ptr<TestImage> > images;
+    std::vector< DenoiserData > data;
+    for( int i=0; i < 12; i++ )
+    {
+        images.emplace_back( new TestImage( 64, 64, rng ) );
+        data.push_back( images.back()->data );
+    }
+    const uint64_t before = scheduler.completed( 1 );
+    CHECK( pool->denoiseImages( data ) == data.size() );
+    CHECK( scheduler.completed( 1 ) - before < uint64_t( 4 ) * 64 * 64 );
+}
+
+int main()
+{
+    testPartition();
+    testShardedCoverage();
+    testLargestFirst();
+    testThroughputAdaptation();
+
+    if( g_failures )
+    {
+        fprintf( stderr, "%d check(s) failed\n", g_failures );
+        return 1;
+    }
+    printf( "device pool tests passed\n" );
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "flow_warp.h"
+#include "parallel_rows.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 1 )
+#include <xmmintrin.h>
+#define FLOW_WARP_SSE
+#endif
+
+inline float catmull_rom(
+    float       p[4],
+    float       t)
+{
+    return p[1] + 0.5f * t * ( p[2] - p[0] + t * ( 2.f * p[0] - 5.f * p[1] + 4.f * p[2] - p[3] + t * ( 3.f * ( p[1] - p[2]) + p[3] - p[0] ) ) );
+}
+
+void addFlow(
+    float4*             result,
+    const float4*       image,
+    const float4*       flow,
+    unsigned int        width,
+    unsigned int        height,
+    unsigned int        x,
+    unsigned int        y )
+{
+    float dst_x = float( x ) - flow[x + y * width].x;
+    float dst_y = float( y ) - flow[x + y * width].y;
+
+    float x0 = dst_x - 1.f;
+    float y0 = dst_y - 1.f;
+
+    float r[4][4], g[4][4], b[4][4];
+    for (int j=0; j < 4; j++)
+    {
+        for (int k=0; k < 4; k++)
+        {
+            int tx = static_cast<int>( x0 ) + k;
+            if( tx < 0 )
+                tx = 0;
+            else if( tx >= (int)width )
+                tx = width - 1;
+
+            int ty = static_cast<int>( y0 ) + j;
+            if( ty < 0 )
+                ty = 0;
+            else if( ty >= (int)height )
+                ty = height - 1;
+
+            r[j][k] = image[tx + ty * width].x;
+            g[j][k] = image[tx + ty * width].y;
+            b[j][k] = image[tx + ty * width].z;
+        }
+    }
+    float tx = dst_x <= 0.f ? 0.f : dst_x - floorf( dst_x );
+
+    r[0][0] = catmull_rom( r[0], tx );
+    r[0][1] = catmull_rom( r[1], tx );
+    r[0][2] = catmull_rom( r[2], tx );
+    r[0][3] = catmull_rom( r[3], tx );
+
+    g[0][0] = catmull_rom( g[0], tx );
+    g[0][1] = catmull_rom( g[1], tx );
+    g[0][2] = catmull_rom( g[2], tx );
+    g[0][3] = catmull_rom( g[3], tx );
+
+    b[0][0] = catmull_rom( b[0], tx );
+    b[0][1] = catmull_rom( b[1], tx );
+    b[0][2] = catmull_rom( b[2], tx );
+    b[0][3] = catmull_rom( b[3], tx );
+
+    float ty = dst_y <= 0.f ? 0.f : dst_y - floorf( dst_y );
+
+    result[y * width + x].x = catmull_rom( r[0], ty );
+    result[y * width + x].y = catmull_rom( g[0], ty );
+    result[y * width + x].z = catmull_rom( b[0], ty );
+}
+
+
+// one float4 pixel per vector register where SSE is available
+#ifdef FLOW_WARP_SSE
+typedef __m128 Pixel;
+static inline Pixel loadPixel( const float4* p )           { return _mm_loadu_ps( &p->x ); }
+static inline Pixel scalePixel( const Pixel& p, float w )  { return _mm_mul_ps( p, _mm_set1_ps( w ) ); }
+static inline Pixel addScaled( const Pixel& acc, const Pixel& p, float w ) { return _mm_add_ps( acc, _mm_mul_ps( p, _mm_set1_ps( w ) ) ); }
+static inline void  storePixel( float4* dst, const Pixel& p )
+{
+    const float alpha = dst->w;
+    _mm_storeu_ps( &dst->x, p );
+    dst->w = alpha;
+}
+#else
+typedef float4 Pixel;
+static inline Pixel loadPixel( const float4* p )           { return *p; }
+static inline Pixel scalePixel( const Pixel& p, float w )  { return Pixel{ p.x * w, p.y * w, p.z * w, p.w * w }; }
+static inline Pixel addScaled( const Pixel& acc, const Pixel& p, float w )
+{
+    return Pixel{ acc.x + p.x * w, acc.y + p.y * w, acc.z + p.z * w, acc.w + p.w * w };
+}
+static inline void  storePixel( float4* dst, const Pixel& p )
+{
+    dst->x = p.x;
+    dst->y = p.y;
+    dst->z = p.z;
+}
+#endif
+
+// Catmull-Rom weights of the four taps around t, the expanded form of catmull_rom
+static inline void catmullRomWeights( float t, float w[4] )
+{
+    const float t2 = t * t;
+    const float t3 = t2 * t;
+    w[0] = 0.5f * ( -t + 2.f * t2 - t3 );
+    w[1] = 1.f + 0.5f * ( -5.f * t2 + 3.f * t3 );
+    w[2] = 0.5f * ( t + 4.f * t2 - 3.f * t3 );
+    w[3] = 0.5f * ( t3 - t2 );
+}
+
+// first tap and fraction along one axis, as addFlow places them
+static inline void tapPosition( float position, int& first, float& t )
+{
+    first = static_cast<int>( position - 1.f );
+    t     = position <= 0.f ? 0.f : position - floorf( position );
+}
+
+// weighted sum of four rows of four taps: horizontal pass per row, then vertical
+static inline Pixel filterTaps( const float4* const rows[4], const int columns[4], const float wx[4], const float wy[4] )
+{
+    Pixel result = {};
+    for( int j=0; j < 4; j++ )
+    {
+        const float4* row = rows[j];
+        Pixel h = scalePixel( loadPixel( row + columns[0] ), wx[0] );
+        h = addScaled( h, loadPixel( row + columns[1] ), wx[1] );
+        h = addScaled( h, loadPixel( row + columns[2] ), wx[2] );
+        h = addScaled( h, loadPixel( row + columns[3] ), wx[3] );
+        result = j == 0 ? scalePixel( h, wy[0] ) : addScaled( result, h, wy[j] );
+    }
+    return result;
+}
+
+void warpImages(
+    float4* const*       results,
+    const float4* const* images,
+    size_t               count,
+    const float4*        flow,
+    unsigned int         width,
+    unsigned int         height )
+{
+    if( count == 0 || width == 0 || height == 0 )
+        return;
+
+    parallelRows( height, [&]( unsigned int y_begin, unsigned int y_end )
+    {
+        const int w = int( width );
+        const int h = int( height );
+        for( unsigned int y = y_begin; y < y_end; y++ )
+        {
+            for( unsigned int x = 0; x < width; x++ )
+            {
+                const size_t  p      = size_t( y ) * width + x;
+                const float4& motion = flow[p];
+
+                int   x0, y0;
+                float tx, ty;
+                tapPosition( float( x ) - motion.x, x0, tx );
+                tapPosition( float( y ) - motion.y, y0, ty );
+                float wx[4], wy[4];
+                catmullRomWeights( tx, wx );
+                catmullRomWeights( ty, wy );
+
+                int  columns[4];
+                int  rows[4];
+                const bool interior = x0 >= 0 && x0 + 3 < w && y0 >= 0 && y0 + 3 < h;
+                for( int k=0; k < 4; k++ )
+                {
+                    columns[k] = interior ? x0 + k : std::min( std::max( x0 + k, 0 ), w - 1 );
+                    rows[k]    = interior ? y0 + k : std::min( std::max( y0 + k, 0 ), h - 1 );
+                }
+
+                for( size_t i=0; i < count; i++ )
+                {
+                    const float4* image = images[i];
+                    const float4* tapRows[4] = { image + size_t( rows[0] ) * width, image + size_t( rows[1] ) * width,
+                                                 image + size_t( rows[2] ) * width, image + size_t( rows[3] ) * width };
+                    results[i][p].w = image[p].w;
+                    storePixel( &results[i][p], filterTaps( tapRows, columns, wx, wy ) );
+                }
+            }
+        }
+    } );
+}
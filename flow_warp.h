@@ -0,0 +1,25 @@
+#pragma once
+#include "denoiser_backend.h"
+
+// apply flow to image at given pixel position (using bilinear interpolation), write back RGB result.
+void addFlow(
+    float4*             result,
+    const float4*       image,
+    const float4*       flow,
+    unsigned int        width,
+    unsigned int        height,
+    unsigned int        x,
+    unsigned int        y );
+
+// Warp count images of width x height float4 pixels by flow: results[i] receives what addFlow
+// computes for every pixel of images[i], with alpha copied unchanged. The filter taps and
+// weights of a pixel are computed once for all images, pixels whose taps lie inside the image
+// skip the edge clamping, and rows are spread over the hardware threads. results must not
+// alias images.
+void warpImages(
+    float4* const*       results,
+    const float4* const* images,
+    size_t               count,
+    const float4*        flow,
+    unsigned int         width,
+    unsigned int         height );
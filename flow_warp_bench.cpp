@@ -0,0 +1,88 @@
+// Throughput of the flow warp: the per pixel addFlow loop against warpImages.
+// usage: FlowWarpBench [width height layers]
+#include "flow_warp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock BenchClock;
+
+// best of a few runs, in seconds
+template< typename Fn >
+static double timeBest( const Fn& fn, int runs )
+{
+    double best = 1e30;
+    for( int i = 0; i < runs; i++ )
+    {
+        const BenchClock::time_point start = BenchClock::now();
+        fn();
+        best = std::min( best, std::chrono::duration<double>( BenchClock::now() - start ).count() );
+    }
+    return best;
+}
+
+int main( int argc, char** argv )
+{
+    const unsigned int width  = argc > 3 ? unsigned( atoi( argv[1] ) ) : 1920;
+    const unsigned int height = argc > 3 ? unsigned( atoi( argv[2] ) ) : 1080;
+    const size_t       layers = argc > 3 ? size_t( atoi( argv[3] ) ) : 3;
+    const size_t       pixels = size_t( width ) * height;
+
+    // smooth image content, motion of a few pixels with some vectors pointing off the image
+    std::mt19937 rng( 1 );
+    std::uniform_real_distribution<float> noise( -0.05f, 0.05f );
+    std::uniform_real_distribution<float> motion( -6.f, 6.f );
+    std::vector< std::vector< float4 > > images( layers, std::vector< float4 >( pixels ) );
+    for( size_t i = 0; i < layers; i++ )
+        for( size_t p = 0; p < pixels; p++ )
+        {
+            const float x = float( p % width ) / width;
+            const float y = float( p / width ) / height;
+            images[i][p] = float4{ x + noise( rng ), y + noise( rng ), float( i ) * 0.1f + noise( rng ), 1.f };
+        }
+    std::vector< float4 > flow( pixels );
+    for( size_t p = 0; p < pixels; p++ )
+        flow[p] = float4{ motion( rng ), motion( rng ), 0.f, 0.f };
+
+    std::vector< std::vector< float4 > > reference( images );
+    std::vector< std::vector< float4 > > warped( layers, std::vector< float4 >( pixels ) );
+    std::vector< float4* >       results( layers );
+    std::vector< const float4* > inputs( layers );
+    for( size_t i = 0; i < layers; i++ )
+    {
+        results[i] = warped[i].data();
+        inputs[i]  = images[i].data();
+    }
+
+    const double scalar = timeBest( [&]() {
+        for( size_t i = 0; i < layers; i++ )
+            for( unsigned int y = 0; y < height; y++ )
+                for( unsigned int x = 0; x < width; x++ )
+                    addFlow( reference[i].data(), images[i].data(), flow.data(), width, height, x, y );
+    }, 3 );
+    const double engine = timeBest( [&]() {
+        warpImages( results.data(), inputs.data(), layers, flow.data(), width, height );
+    }, 10 );
+
+    float max_error = 0.f;
+    for( size_t i = 0; i < layers; i++ )
+        for( size_t p = 0; p < pixels; p++ )
+        {
+            max_error = std::max( max_error, std::fabs( reference[i][p].x - warped[i][p].x ) );
+            max_error = std::max( max_error, std::fabs( reference[i][p].y - warped[i][p].y ) );
+            max_error = std::max( max_error, std::fabs( reference[i][p].z - warped[i][p].z ) );
+            max_error = std::max( max_error, std::fabs( reference[i][p].w - warped[i][p].w ) );
+        }
+
+    const double mpixels = double( pixels * layers ) * 1e-6;
+    printf( "%ux%u, %zu layers\n", width, height, layers );
+    printf( "addFlow     %8.2f ms  %8.1f Mpix/s\n", scalar * 1e3, mpixels / scalar );
+    printf( "warpImages  %8.2f ms  %8.1f Mpix/s  (%.1fx)\n", engine * 1e3, mpixels / engine, scalar / engine );
+    printf( "max difference %g\n", max_error );
+    return 0;
+}
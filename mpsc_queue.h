@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+
+// Link embedded in every element of an MpscQueue.
+struct MpscNode
+{
+    std::atomic<MpscNode*> next{ nullptr };
+};
+
+// Intrusive unbounded queue for many producers and a single consumer (Vyukov's algorithm).
+// push never blocks or locks: it is one atomic exchange plus a store, so any thread may call it
+// at any time. pop must only be called from the consumer thread. T derives from MpscNode; the
+// queue never owns its elements.
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : m_head( &m_stub )
+        , m_tail( &m_stub )
+    {
+    }
+
+    MpscQueue( const MpscQueue& ) = delete;
+    MpscQueue& operator=( const MpscQueue& ) = delete;
+
+    void push( T* element ) { pushNode( element ); }
+
+    // Oldest element, or nullptr if the queue is empty. May also return nullptr while a push
+    // is halfway done; that producer's element becomes visible once its push returns.
+    T* pop()
+    {
+        MpscNode* tail = m_tail;
+        MpscNode* next = tail->next.load( std::memory_order_acquire );
+        if( tail == &m_stub )
+        {
+            if( !next )
+                return nullptr;
+            m_tail = next;
+            tail   = next;
+            next   = next->next.load( std::memory_order_acquire );
+        }
+        if( next )
+        {
+            m_tail = next;
+            return static_cast<T*>( tail );
+        }
+        if( tail != m_head.load( std::memory_order_acquire ) )
+            return nullptr;
+        // tail is the last element: park the stub behind it so that tail can be handed out
+        pushNode( &m_stub );
+        next = tail->next.load( std::memory_order_acquire );
+        if( next )
+        {
+            m_tail = next;
+            return static_cast<T*>( tail );
+        }
+        return nullptr;
+    }
+
+private:
+    void pushNode( MpscNode* node )
+    {
+        node->next.store( nullptr, std::memory_order_relaxed );
+        MpscNode* prev = m_head.exchange( node, std::memory_order_acq_rel );
+        prev->next.store( node, std::memory_order_release );
+    }
+
+    std::atomic<MpscNode*> m_head;   // last pushed, written by producers
+    MpscNode*              m_tail;   // next to pop, consumer only
+    MpscNode               m_stub;
+};
@@ -0,0 +1,2225 @@
+#include "denoiser_backend.h"
+#include "arena_allocator.h"
+#include "debug.h"
+#include "denoiser_model.h"
+#include "flow_warp.h"
+#include "pixel_format.h"
+
+#define NOMINMAX
+#include <cuda_runtime.h>
+#include <optix.h>
+#include <optix_function_table_definition.h>
+#include <optix_stubs.h>
+
+#include <optix_denoiser_tiling.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
+
+#define CUDA_CHECK( call )                                                     \
+    do                                                                         \
+    {                                                                          \
+        cudaError_t error = call;                                              \
+        if( error != cudaSuccess )                                             \
+            LOG_ERROR( "CUDA call (%s ) failed with error: '%s' (%s:%d)",      \
+                       #call, cudaGetErrorString( error ), __FILE__, __LINE__ ); \
+    } while( 0 )
+
+#define OPTIX_CHECK( call )                                                    \
+    do                                                                         \
+    {                                                                          \
+        OptixResult res = call;                                                \
+        if( res != OPTIX_SUCCESS )                                             \
+            LOG_ERROR( "Optix call '%s' failed: %s:%d)", #call, __FILE__, __LINE__ ); \
+    } while( 0 )
+
+// optixInit loads the function table and is not safe to race from several denoiser instances
+static OptixResult initOptiX()
+{
+    static std::once_flag s_once;
+    static OptixResult    s_result = OPTIX_SUCCESS;
+    std::call_once( s_once, []() { s_result = optixInit(); } );
+    return s_result;
+}
+
+static void context_log_cb( uint32_t level, const char* tag, const char* message, void* /*cbdata*/ )
+{
+    // 1 fatal, 2 error, 3 warning, 4 print
+    if( level <= 2 )
+        LOG_ERROR( "[%2u][%12s]: %s", level, tag, message );
+    else if( level == 3 )
+        LOG_WARNING( "[%2u][%12s]: %s", level, tag, message );
+    else
+        LOG_DEBUG( "[%2u][%12s]: %s", level, tag, message );
+}
+
+// copy host pixels with rows hpitch bytes apart (0 = tightly packed) into the (possibly
+// pitched) device image, ordered on stream. kind is cudaMemcpyDeviceToDevice for sources that
+// already live in device memory.
+static void uploadOptixImage2D( const OptixImage2D& oi, const float* hmem, cudaStream_t stream,
+                                cudaMemcpyKind kind = cudaMemcpyHostToDevice, size_t hpitch = 0 )
+{
+    CUDA_CHECK( cudaMemcpy2DAsync(
+                reinterpret_cast<void*>( oi.data ),
+                oi.rowStrideInBytes,
+                hmem,
+                hpitch ? hpitch : oi.width * oi.pixelStrideInBytes,
+                oi.width * oi.pixelStrideInBytes,
+                oi.height,
+                kind,
+                stream
+                ) );
+}
+
+// copy the active region of a device image into host memory with rows hpitch bytes apart
+// (0 = tightly packed), ordered on stream. The host memory is only valid after the stream has
+// been synchronized.
+static void downloadOptixImage2D( float* hmem, const OptixImage2D& oi, cudaStream_t stream, size_t hpitch = 0 )
+{
+    CUDA_CHECK( cudaMemcpy2DAsync(
+                hmem,
+                hpitch ? hpitch : oi.width * oi.pixelStrideInBytes,
+                reinterpret_cast<void*>( oi.data ),
+                oi.rowStrideInBytes,
+                oi.width * oi.pixelStrideInBytes,
+                oi.height,
+                cudaMemcpyDeviceToHost,
+                stream
+                ) );
+}
+
+static OptixPixelFormat toOptixPixelFormat( DenoiserPixelFormat format )
+{
+    switch( format )
+    {
+    case DenoiserPixelFormat::Float3: return OPTIX_PIXEL_FORMAT_FLOAT3;
+    case DenoiserPixelFormat::Half4:  return OPTIX_PIXEL_FORMAT_HALF4;
+    case DenoiserPixelFormat::Half3:  return OPTIX_PIXEL_FORMAT_HALF3;
+    default:                          return OPTIX_PIXEL_FORMAT_FLOAT4;
+    }
+}
+
+// Device memory of one CUDA device, carved out of large slabs. Denoiser buffers are
+// sub-allocated instead of going through cudaMalloc/cudaFree each, and released slabs stay
+// allocated for the next session until trimDeviceMemory. A session reserves its whole
+// footprint up front, so it normally lives in a single slab. Releasing memory does not
+// synchronize the device like cudaFree does: callers wait for their streams first.
+class DeviceArena
+{
+public:
+    // make sure a slab with bytes of contiguous free space exists; false if the device is out
+    // of memory
+    bool reserve( size_t bytes );
+
+    // 0 if the device is out of memory
+    CUdeviceptr allocate( size_t bytes );
+
+    // false if ptr does not belong to this arena
+    bool release( CUdeviceptr ptr );
+
+    // free the slabs without live allocations
+    void trim();
+
+private:
+    struct Slab
+    {
+        CUdeviceptr    base = 0;
+        ArenaAllocator allocator;
+    };
+
+    // new slab of at least bytes, nullptr if cudaMalloc failed; slabs smaller than this are not
+    // worth the call
+    Slab* addSlab( size_t bytes );
+    void  freeUnusedSlabs();    // m_mutex held
+
+    static const size_t kMinSlabBytes = 32 << 20;
+
+    std::mutex          m_mutex;
+    std::vector< Slab > m_slabs;
+};
+
+DeviceArena::Slab* DeviceArena::addSlab( size_t bytes )
+{
+    const size_t granularity = 2 << 20;
+    const size_t size = ( std::max( bytes, kMinSlabBytes ) + granularity - 1 ) / granularity * granularity;
+    Slab slab;
+    const cudaError_t error = cudaMalloc( reinterpret_cast<void**>( &slab.base ), size );
+    if( error != cudaSuccess )
+    {
+        cudaGetLastError();     // out of memory is not sticky, later calls may still succeed
+        LOG_ERROR( "Denoiser device memory allocation of %zu bytes failed: '%s'", size, cudaGetErrorString( error ) );
+        return nullptr;
+    }
+    slab.allocator = ArenaAllocator( size );
+    m_slabs.push_back( slab );
+    return &m_slabs.back();
+}
+
+bool DeviceArena::reserve( size_t bytes )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    for( const Slab& slab : m_slabs )
+    {
+        if( slab.allocator.largestFree() >= bytes )
+            return true;
+    }
+    // unused slabs that are too small are replaced rather than kept next to the new one
+    freeUnusedSlabs();
+    return addSlab( bytes ) != nullptr;
+}
+
+CUdeviceptr DeviceArena::allocate( size_t bytes )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    for( Slab& slab : m_slabs )
+    {
+        const size_t offset = slab.allocator.allocate( bytes );
+        if( offset != ArenaAllocator::kInvalid )
+            return slab.base + offset;
+    }
+    Slab* slab = addSlab( bytes );
+    if( !slab )
+    {
+        // the cached slabs of finished sessions may be what is in the way
+        freeUnusedSlabs();
+        slab = addSlab( bytes );
+    }
+    if( !slab )
+        return 0;
+    const size_t offset = slab->allocator.allocate( bytes );
+    return offset != ArenaAllocator::kInvalid ? slab->base + offset : 0;
+}
+
+bool DeviceArena::release( CUdeviceptr ptr )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    for( Slab& slab : m_slabs )
+    {
+        if( ptr >= slab.base && ptr < slab.base + slab.allocator.capacity() )
+        {
+            slab.allocator.release( size_t( ptr - slab.base ) );
+            return true;
+        }
+    }
+    return false;
+}
+
+void DeviceArena::trim()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    freeUnusedSlabs();
+}
+
+void DeviceArena::freeUnusedSlabs()
+{
+    for( size_t i = m_slabs.size(); i-- > 0; )
+    {
+        if( m_slabs[i].allocator.empty() )
+        {
+            CUDA_CHECK( cudaFree( reinterpret_cast<void*>( m_slabs[i].base ) ) );
+            m_slabs.erase( m_slabs.begin() + i );
+        }
+    }
+}
+
+// added to a session's reservation for the intensity / average color values and the
+// alignment of every buffer
+static const size_t kArenaHeadroom = 16 * 256;
+
+static std::mutex                     s_arenaMutex;
+static std::map< int, DeviceArena* >  s_arenas;    // by device ordinal, never destroyed
+
+// arena of the calling thread's current device
+static DeviceArena& currentDeviceArena()
+{
+    int device = 0;
+    CUDA_CHECK( cudaGetDevice( &device ) );
+    std::lock_guard<std::mutex> lock( s_arenaMutex );
+    DeviceArena*& arena = s_arenas[device];
+    if( !arena )
+        arena = new DeviceArena();
+    return *arena;
+}
+
+static CUdeviceptr deviceAlloc( size_t bytes )
+{
+    return currentDeviceArena().allocate( bytes );
+}
+
+// 0 is ignored, like cudaFree( nullptr )
+static void deviceFree( CUdeviceptr ptr )
+{
+    if( !ptr )
+        return;
+    std::lock_guard<std::mutex> lock( s_arenaMutex );
+    for( auto& arena : s_arenas )
+    {
+        if( arena.second->release( ptr ) )
+            return;
+    }
+}
+
+void trimDeviceMemory()
+{
+    std::lock_guard<std::mutex> lock( s_arenaMutex );
+    for( auto& arena : s_arenas )
+        arena.second->trim();
+}
+
+// create OptixImage2D with given dimension and format. allocate memory on device for
+// alloc_width x alloc_height pixels (at least width x height) and copy data from host memory
+// given in hmem to device if hmem is nonzero. width/height describe the active sub-rectangle,
+// rowStrideInBytes the allocation.
+static OptixImage2D createOptixImage2D( unsigned int width, unsigned int height, const float * hmem = nullptr,
+                                        unsigned int alloc_width = 0, unsigned int alloc_height = 0,
+                                        cudaStream_t stream = nullptr,
+                                        DenoiserPixelFormat format = DenoiserPixelFormat::Float4 ) 
+{
+    OptixImage2D oi;
+
+    alloc_width  = std::max( alloc_width, width );
+    alloc_height = std::max( alloc_height, height );
+
+    const unsigned int pixel_size = pixelSizeInBytes( format );
+    const uint64_t frame_byte_size = uint64_t( alloc_width ) * alloc_height * pixel_size;
+    oi.data = deviceAlloc( frame_byte_size );
+    oi.width              = width;
+    oi.height             = height;
+    oi.rowStrideInBytes   = alloc_width*pixel_size;
+    oi.pixelStrideInBytes = pixel_size;
+    oi.format             = toOptixPixelFormat( format );
+    if( hmem )
+        uploadOptixImage2D( oi, hmem, stream );
+    return oi;
+}
+
+// describe caller owned device memory holding width x height pixels with rows rowStride bytes
+// apart; nothing is allocated or copied
+static OptixImage2D wrapOptixImage2D( unsigned int width, unsigned int height, const float* dmem,
+                                      DenoiserPixelFormat format, size_t rowStride )
+{
+    OptixImage2D oi;
+    oi.data               = reinterpret_cast<CUdeviceptr>( dmem );
+    oi.width              = width;
+    oi.height             = height;
+    oi.rowStrideInBytes   = static_cast<unsigned int>( rowStride );
+    oi.pixelStrideInBytes = pixelSizeInBytes( format );
+    oi.format             = toOptixPixelFormat( format );
+    return oi;
+}
+
+// view of the w x h rectangle at (x, y) of an image, sharing its memory
+static OptixImage2D subImage2D( const OptixImage2D& oi, unsigned int x, unsigned int y, unsigned int w, unsigned int h )
+{
+    OptixImage2D sub = oi;
+    if( oi.data )
+        sub.data = oi.data + size_t( y ) * oi.rowStrideInBytes + size_t( x ) * oi.pixelStrideInBytes;
+    sub.width  = w;
+    sub.height = h;
+    return sub;
+}
+
+// address of pixel (x, y) in host memory with rows pitch bytes apart
+static float* hostPixel( float* image, size_t pitch, DenoiserPixelFormat format, unsigned int x, unsigned int y )
+{
+    return reinterpret_cast<float*>( reinterpret_cast<char*>( image ) + y * pitch + size_t( x ) * pixelSizeInBytes( format ) );
+}
+
+// wrap the region of a caller owned device image described by layout
+static OptixImage2D wrapOptixImage2D( const DenoiserData& data, float* dmem, const DenoiserImageLayout& layout,
+                                      DenoiserPixelFormat format )
+{
+    return wrapOptixImage2D( data.width, data.height, layout.regionStart( dmem, data.width, format ), format,
+                             layout.rowStrideInBytes( data.width, format ) );
+}
+
+static bool isPinnedHostPointer( const void* ptr )
+{
+    cudaPointerAttributes attributes = {};
+    if( cudaPointerGetAttributes( &attributes, ptr ) != cudaSuccess )
+    {
+        cudaGetLastError();     // older runtimes report pageable memory as an error
+        return false;
+    }
+    return attributes.type == cudaMemoryTypeHost;
+}
+
+// Device image buffers init allocates for config (caller owned device images excluded), at the
+// bucketed allocation size. Tiling does not change them.
+static void imageRequirements( const DenoiserConfig& config, DenoiserMemoryRequirements& requirements )
+{
+    const size_t pixels = size_t( bucketImageDimension( config.width ) ) * bucketImageDimension( config.height );
+    const size_t layers = 1 + config.aovs;
+    requirements.inputs  = pixels * pixelSizeInBytes( config.inputFormat ) * ( layers - ( config.colorOnDevice ? 1 : 0 ) );
+    requirements.outputs = pixels * pixelSizeInBytes( config.outputFormat ) * ( layers - ( config.outputOnDevice ? 1 : 0 ) );
+    requirements.guides  = pixels * pixelSizeInBytes( config.guideFormat )
+                           * ( ( config.albedo && !config.albedoOnDevice ? 1 : 0 ) + ( config.normal && !config.normalOnDevice ? 1 : 0 ) );
+    requirements.flow    = config.temporalMode ? pixels * sizeof( float4 ) : 0;
+    // temporal history, one per layer
+    if( config.temporalMode )
+        requirements.outputs += pixels * pixelSizeInBytes( config.outputFormat ) * layers;
+}
+
+static OptixDenoiserModelKind denoiserModelKind( bool kpMode, size_t aovs, bool temporalMode )
+{
+    if( kpMode || aovs > 0 )
+        return OPTIX_DENOISER_MODEL_KIND_AOV;
+    return temporalMode ? OPTIX_DENOISER_MODEL_KIND_TEMPORAL : OPTIX_DENOISER_MODEL_KIND_HDR;
+}
+
+// Pick a tile size for a width x height image whose scratch and state fit into budget bytes.
+// Every tile is denoised together with an overlap border on each side, so more and thinner
+// tiles cost more: among the tilings that fit, the one denoising the fewest pixels (borders
+// included) wins. Tiles split the image evenly to avoid a sliver of a last tile. Returns
+// false if not even the smallest tile fits; tileWidth/tileHeight are 0 if the untiled image
+// fits, the smallest tile if nothing does.
+static bool chooseTileSize( OptixDenoiser denoiser, unsigned int width, unsigned int height, size_t budget,
+                            unsigned int& tileWidth, unsigned int& tileHeight )
+{
+    OptixDenoiserSizes sizes;
+    OPTIX_CHECK( optixDenoiserComputeMemoryResources( denoiser, width, height, &sizes ) );
+    tileWidth  = 0;
+    tileHeight = 0;
+    if( std::max( sizes.withoutOverlapScratchSizeInBytes, sizes.withOverlapScratchSizeInBytes ) + sizes.stateSizeInBytes <= budget )
+        return true;
+
+    // tiles narrower than the overlap would mostly denoise borders
+    const unsigned int overlap = sizes.overlapWindowSizeInPixels;
+    const unsigned int minTile = std::max( 64u, overlap );
+    auto roundUp = []( unsigned int v ) { return ( v + 7 ) / 8 * 8; };
+
+    OPTIX_CHECK( optixDenoiserComputeMemoryResources( denoiser, std::min( width, minTile ), std::min( height, minTile ), &sizes ) );
+    if( sizes.withOverlapScratchSizeInBytes + sizes.stateSizeInBytes > budget )
+    {
+        tileWidth  = std::min( width, minTile );
+        tileHeight = std::min( height, minTile );
+        return false;
+    }
+
+    uint64_t bestCost = 0;
+    for( unsigned int nx = 1; ; nx++ )
+    {
+        const unsigned int tw = std::min( width, roundUp( ( width + nx - 1 ) / nx ) );
+        if( nx > 1 && tw < minTile )
+            break;
+        for( unsigned int ny = 1; ; ny++ )
+        {
+            const unsigned int th = std::min( height, roundUp( ( height + ny - 1 ) / ny ) );
+            if( ny > 1 && th < minTile )
+                break;
+            OPTIX_CHECK( optixDenoiserComputeMemoryResources( denoiser, tw, th, &sizes ) );
+            if( sizes.withOverlapScratchSizeInBytes + sizes.stateSizeInBytes > budget )
+                continue;
+            // tiles only shrink from here on, so the first fitting ny is the cheapest for nx
+            const uint64_t tiles = uint64_t( ( width + tw - 1 ) / tw ) * ( ( height + th - 1 ) / th );
+            const uint64_t cost  = tiles * ( tw + 2 * overlap ) * ( th + 2 * overlap );
+            if( tileWidth == 0 || cost < bestCost )
+            {
+                tileWidth  = tw;
+                tileHeight = th;
+                bestCost   = cost;
+            }
+            break;
+        }
+    }
+    if( tileWidth > 0 )
+        return true;
+    tileWidth  = std::min( width, minTile );
+    tileHeight = std::min( height, minTile );
+    return false;
+}
+
+// Page-locked double buffer that moves pageable host memory to and from the device in
+// chunks of rows: while one half is transferred by DMA, the CPU fills or drains the other.
+class HostStaging
+{
+public:
+    // host rows are pitch bytes apart
+    void upload( const OptixImage2D& dst, const float* src, size_t pitch, cudaStream_t stream );
+    void download( float* dst, size_t pitch, const OptixImage2D& src, cudaStream_t stream );
+    void release();
+
+private:
+    void reserve( size_t row_bytes );
+
+public:
+    static const size_t   kChunkBytes = 4 << 20;
+
+    // page-locked memory held for rows of up to row_bytes
+    static size_t footprint( size_t row_bytes ) { return 2 * std::max( kChunkBytes, row_bytes ); }
+
+private:
+
+    unsigned char*        m_buffer[2]   = {};
+    cudaEvent_t           m_event[2]    = {};
+    size_t                m_chunk_bytes = 0;
+};
+
+void HostStaging::reserve( size_t row_bytes )
+{
+    const size_t chunk_bytes = std::max( kChunkBytes, row_bytes );
+    if( chunk_bytes <= m_chunk_bytes )
+        return;
+
+    release();
+    for( int k = 0; k < 2; k++ )
+    {
+        CUDA_CHECK( cudaHostAlloc( reinterpret_cast<void**>( &m_buffer[k] ), chunk_bytes, cudaHostAllocDefault ) );
+        CUDA_CHECK( cudaEventCreateWithFlags( &m_event[k], cudaEventDisableTiming ) );
+    }
+    m_chunk_bytes = chunk_bytes;
+}
+
+void HostStaging::upload( const OptixImage2D& dst, const float* src, size_t pitch, cudaStream_t stream )
+{
+    const size_t row_bytes = dst.width * dst.pixelStrideInBytes;
+    reserve( row_bytes );
+    const unsigned int rows_per_chunk = static_cast<unsigned int>( m_chunk_bytes / row_bytes );
+
+    const unsigned char* src_bytes = reinterpret_cast<const unsigned char*>( src );
+    int k = 0;
+    for( unsigned int y = 0; y < dst.height; y += rows_per_chunk, k ^= 1 )
+    {
+        const unsigned int rows = std::min( rows_per_chunk, dst.height - y );
+
+        // wait until the previous transfer out of this half has finished
+        CUDA_CHECK( cudaEventSynchronize( m_event[k] ) );
+        copyImageRows( m_buffer[k], row_bytes, src_bytes + y * pitch, pitch, row_bytes, rows );
+        CUDA_CHECK( cudaMemcpy2DAsync(
+                    reinterpret_cast<void*>( dst.data + size_t( y ) * dst.rowStrideInBytes ),
+                    dst.rowStrideInBytes,
+                    m_buffer[k],
+                    row_bytes,
+                    row_bytes,
+                    rows,
+                    cudaMemcpyHostToDevice,
+                    stream
+                    ) );
+        CUDA_CHECK( cudaEventRecord( m_event[k], stream ) );
+    }
+}
+
+void HostStaging::download( float* dst, size_t pitch, const OptixImage2D& src, cudaStream_t stream )
+{
+    const size_t row_bytes = src.width * src.pixelStrideInBytes;
+    reserve( row_bytes );
+    const unsigned int rows_per_chunk = static_cast<unsigned int>( m_chunk_bytes / row_bytes );
+
+    unsigned char* dst_bytes = reinterpret_cast<unsigned char*>( dst );
+    unsigned int pending_y    = 0;
+    unsigned int pending_rows = 0;
+    int k = 0;
+    for( unsigned int y = 0; y < src.height; y += rows_per_chunk, k ^= 1 )
+    {
+        const unsigned int rows = std::min( rows_per_chunk, src.height - y );
+        CUDA_CHECK( cudaMemcpy2DAsync(
+                    m_buffer[k],
+                    row_bytes,
+                    reinterpret_cast<const void*>( src.data + size_t( y ) * src.rowStrideInBytes ),
+                    src.rowStrideInBytes,
+                    row_bytes,
+                    rows,
+                    cudaMemcpyDeviceToHost,
+                    stream
+                    ) );
+        CUDA_CHECK( cudaEventRecord( m_event[k], stream ) );
+
+        // drain the other half while this chunk is in flight
+        if( pending_rows )
+        {
+            CUDA_CHECK( cudaEventSynchronize( m_event[k ^ 1] ) );
+            copyImageRows( dst_bytes + pending_y * pitch, pitch, m_buffer[k ^ 1], row_bytes, row_bytes, pending_rows );
+        }
+        pending_y    = y;
+        pending_rows = rows;
+    }
+    if( pending_rows )
+    {
+        CUDA_CHECK( cudaEventSynchronize( m_event[k ^ 1] ) );
+        copyImageRows( dst_bytes + pending_y * pitch, pitch, m_buffer[k ^ 1], row_bytes, row_bytes, pending_rows );
+    }
+}
+
+void HostStaging::release()
+{
+    for( int k = 0; k < 2; k++ )
+    {
+        if( m_buffer[k] )
+            CUDA_CHECK( cudaFreeHost( m_buffer[k] ) );
+        if( m_event[k] )
+            CUDA_CHECK( cudaEventDestroy( m_event[k] ) );
+        m_buffer[k] = nullptr;
+        m_event[k]  = nullptr;
+    }
+    m_chunk_bytes = 0;
+}
+
+class OptiXDenoiser : public DenoiserBackend
+{
+public:
+    // device: CUDA device all work of this denoiser runs on, -1 for the thread's current device
+    explicit OptiXDenoiser( int device = -1 ) : m_device( device ) {}
+
+    bool init( const Data&  data,
+               unsigned int tileWidth = 0,
+               unsigned int tileHeight = 0,
+               bool         kpMode = false,
+               bool         temporalMode = false ) override;
+
+    void exec() override;
+
+    uint64_t execAsync() override;
+
+    bool poll( uint64_t ticket ) override;
+
+    void wait( uint64_t ticket ) override;
+
+    void update( const Data& data ) override;
+
+    void getResults() override;
+
+    void finish() override;
+
+    void getFlowResults() override;
+
+    void execRegion( const Data& data, unsigned int x, unsigned int y, unsigned int width, unsigned int height ) override;
+
+    void setHostStaging( bool enabled ) override { m_useStaging = enabled; }
+
+    void setMemoryBudget( size_t bytes ) override { m_memoryBudget = bytes; }
+
+    void setExposure( const DenoiserExposure* exposure ) override;
+
+    void setUserModel( const std::shared_ptr<const DenoiserModel>& model ) override { m_userModel = model; }
+
+    DenoiserMemoryRequirements queryMemoryRequirements( const DenoiserConfig& config ) override;
+
+    void setPipelineDepth( unsigned int depth ) override;
+
+    uint64_t submitFrame( const Data& data ) override;
+
+    bool pollFrame( uint64_t frame ) override;
+
+    const float* frameResult( uint64_t frame, size_t layer ) override;
+
+    StageStatistics stageStatistics( DenoiserStage stage ) override;
+    void            resetStageTimings() override;
+
+    DenoiserBackendKind kind() const override { return DenoiserBackendKind::OptiX; }
+    const char*         name() const override { return "OptiX"; }
+
+private:
+    // make m_device current for the calling thread; every entry point that touches CUDA calls
+    // this first, since callers may drive denoisers of different devices from one thread
+    void selectDevice();
+
+    // create the OptiX device context and the stream on first use
+    void createContext();
+
+    // a denoiser of the given kind and guides, or one running the user model if that is set
+    // (which brings its own kind and guides). modelBytes receives the device memory its
+    // creation took, i.e. the model weights, as seen by cudaMemGetInfo.
+    OptixDenoiser createDenoiser( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options, size_t& modelBytes ) const;
+
+    // whether m_denoiser was created for this configuration
+    bool denoiserMatches( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options ) const;
+
+    // Everything optixDenoiserSetup depends on; setup is skipped while it stays the same
+    struct SetupKey
+    {
+        OptixDenoiser denoiser    = nullptr;
+        unsigned int  inputWidth  = 0;     // tile plus overlap
+        unsigned int  inputHeight = 0;
+        CUdeviceptr   state       = 0;
+        size_t        stateSize   = 0;
+        size_t        scratchSize = 0;
+
+        bool operator==( const SetupKey& other ) const
+        {
+            return denoiser == other.denoiser && inputWidth == other.inputWidth && inputHeight == other.inputHeight
+                   && state == other.state && stateSize == other.stateSize && scratchSize == other.scratchSize;
+        }
+    };
+
+    // A denoiser of an earlier configuration, kept with the state it was set up with, so that
+    // switching back to its configuration needs neither optixDenoiserCreate nor, at the same
+    // tile size, optixDenoiserSetup.
+    struct CachedDenoiser
+    {
+        OptixDenoiserModelKind               modelKind;
+        OptixDenoiserOptions                 options;
+        std::shared_ptr<const DenoiserModel> model;
+        OptixDenoiser                        denoiser;
+        size_t                               modelBytes;
+        CUdeviceptr                          state;
+        uint32_t                             stateSize;
+        size_t                               stateCapacity;
+        uint32_t                             scratchSize;
+        unsigned int                         tileWidth;
+        unsigned int                         tileHeight;
+        unsigned int                         overlap;
+        unsigned int                         regionOverlap;
+        bool                                 tiled;
+        SetupKey                             setup;
+    };
+
+    // move m_denoiser and its state to the front of the cache, evicting the least recently
+    // used entry when the cache is full
+    void cacheDenoiser();
+
+    // make the cached denoiser of this configuration current; false if there is none
+    bool restoreDenoiser( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options );
+
+    // the cached denoiser of this configuration, or nullptr
+    const CachedDenoiser* findCachedDenoiser( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options ) const;
+
+    void releaseDenoiserCache();
+
+    // free the per-image device buffers (layers, guides and history)
+    void releaseImages();
+
+    // true if init got all the device memory data asks for
+    bool workingMemoryAllocated( const Data& data ) const;
+    // free images, scratch and state, leaving the backend uninitialized
+    void releaseWorkingMemory();
+
+    // temporal mode: make the previous result the history of the frame about to be denoised
+    void advanceHistory();
+
+    // intensity / average color of the color image on m_stream, or the fixed exposure
+    void computeExposure( const OptixImage2D& color );
+
+    // point all image descriptors at the width x height sub-rectangle of their allocation
+    void resizeImages( unsigned int width, unsigned int height );
+
+    // host <-> device copies of per frame data, host rows pitch bytes apart; pageable memory
+    // goes through the staging buffers when enabled, page-locked memory is copied directly
+    void upload( const OptixImage2D& dst, const float* src, size_t pitch );
+    void download( float* dst, size_t pitch, const OptixImage2D& src );
+
+    // remember where getResults writes to: the output regions of data
+    void setHostOutputs( const Data& data );
+
+    // Device images and page-locked host buffers of one pipelined frame. A frame moves through
+    // three streams: upload -> denoise (m_stream) -> readback, chained by the slot's events, so
+    // the copies of one slot overlap the denoising of another.
+    struct FrameSlot
+    {
+        std::vector< OptixDenoiserLayer > layers;
+        OptixDenoiserGuideLayer           guideLayer  = {};
+        std::vector< float* >             hostInputs;    // staging for pageable sources, created on demand
+        std::vector< float* >             hostOutputs;
+        cudaEvent_t                       uploaded    = nullptr;
+        cudaEvent_t                       denoised    = nullptr;
+        cudaEvent_t                       readBack    = nullptr;
+        uint64_t                          id          = 0;
+    };
+
+    // false if the slot's device images could not be allocated
+    bool createSlot( FrameSlot& slot );
+    void releaseSlots();
+    // point the slots' images at a width x height sub-rectangle of their allocation, like
+    // resizeImages; the slots are idle afterwards
+    void resizeSlots( unsigned int width, unsigned int height );
+    // copy src into the device image on the upload stream, through the slot's page-locked
+    // buffer input if src is pageable
+    void uploadSlotImage( FrameSlot& slot, size_t input, const OptixImage2D& dst, const float* src, size_t pitch, bool onDevice );
+
+    int                   m_device       = -1;
+    OptixDeviceContext    m_context      = nullptr;
+    OptixDenoiser         m_denoiser     = nullptr;
+    OptixDenoiserParams   m_params       = {};
+
+    // all device work of this denoiser is ordered on its own stream
+    cudaStream_t          m_stream       = nullptr;
+
+    // an execAsync submission with the events recorded before its intensity pass, around the
+    // denoiser invocation and after all its work
+    struct Ticket
+    {
+        uint64_t    id       = 0;
+        cudaEvent_t start    = nullptr;
+        cudaEvent_t invoke   = nullptr;
+        cudaEvent_t invoked  = nullptr;
+        cudaEvent_t done     = nullptr;
+    };
+
+    // a pooled event, timing enabled
+    cudaEvent_t acquireEvent();
+    // record the device stages of the oldest ticket, which has completed, and retire it
+    void retireTicket();
+
+    // in flight execAsync tickets, oldest first
+    std::deque< Ticket >       m_inFlight;
+    std::vector< cudaEvent_t > m_freeEvents;
+    uint64_t              m_lastTicket      = 0;
+    uint64_t              m_completedTicket = 0;
+    StageTimings          m_timings;
+
+    // configuration m_denoiser was created with
+    OptixDenoiserModelKind m_modelKind   = OPTIX_DENOISER_MODEL_KIND_HDR;
+    OptixDenoiserOptions   m_options     = {};
+    std::shared_ptr<const DenoiserModel> m_denoiserModel;
+    size_t                 m_modelBytes  = 0;     // device memory of m_denoiser's weights
+
+    // user model for the next init, mapped memory shared with other instances
+    std::shared_ptr<const DenoiserModel> m_userModel;
+
+    // what the current state was set up for
+    SetupKey                             m_setupKey;
+
+    // denoisers of other configurations, most recently used first
+    std::list< CachedDenoiser >          m_denoiserCache;
+    static const size_t                  kDenoiserCacheSize = 4;
+
+    bool                  m_temporalMode = false;
+
+    CUdeviceptr           m_intensity    = 0;
+    CUdeviceptr           m_avgColor     = 0;
+    bool                  m_exposureFixed = false;
+    DenoiserExposure      m_exposure;           // copied to m_intensity / m_avgColor if fixed
+    CUdeviceptr           m_scratch      = 0;
+    uint32_t              m_scratch_size = 0;
+    size_t                m_scratch_capacity = 0;
+    CUdeviceptr           m_state        = 0;
+    uint32_t              m_state_size   = 0;
+    size_t                m_state_capacity = 0;
+
+    // bucketed dimensions the image buffers were allocated with
+    unsigned int          m_allocWidth   = 0;
+    unsigned int          m_allocHeight  = 0;
+
+    unsigned int          m_tileWidth    = 0;
+    unsigned int          m_tileHeight   = 0;
+    unsigned int          m_overlap      = 0;
+    unsigned int          m_regionOverlap = 0;  // context execRegion adds around its rectangle
+    bool                  m_tiled        = false;
+    size_t                m_memoryBudget = 0;   // device bytes for images, scratch and state; 0 = unlimited
+
+    bool                  m_useStaging   = false;
+    HostStaging           m_staging;
+
+    OptixDenoiserGuideLayer           m_guideLayer = {};
+    std::vector< OptixDenoiserLayer > m_layers;
+
+    // temporal mode: the previous result per layer, never the buffer being written. Backend
+    // owned outputs ping-pong with it (exec swaps the two, nothing is copied); a caller owned
+    // device output is copied into it after each frame.
+    std::vector< OptixImage2D >       m_history;
+    bool                              m_historyValid = false;
+    std::vector< float* >             m_host_outputs;       // start of the output region
+
+    // getFlowResults: host copies of the flow and of the layers, kept between calls
+    std::vector< float4 >             m_warpBuffer;
+    std::vector< unsigned char >      m_warpRaw;
+    size_t                            m_outputRowStride = 0;
+
+    // images wrapping caller owned device memory (see DenoiserData); they are rebound on
+    // every update and never freed here
+    bool                              m_colorOnDevice  = false;
+    bool                              m_albedoOnDevice = false;
+    bool                              m_normalOnDevice = false;
+    bool                              m_outputOnDevice = false;
+
+    DenoiserPixelFormat               m_inputFormat    = DenoiserPixelFormat::Float4;
+    DenoiserPixelFormat               m_guideFormat    = DenoiserPixelFormat::Float4;
+    DenoiserPixelFormat               m_outputFormat   = DenoiserPixelFormat::Float4;
+
+    std::vector< FrameSlot >          m_slots;
+    cudaStream_t                      m_uploadStream   = nullptr;
+    cudaStream_t                      m_downloadStream = nullptr;
+    unsigned int                      m_pipelineDepth  = 2;
+    uint64_t                          m_lastFrame      = 0;
+    uint64_t                          m_firstSlotFrame = 1;    // first frame submitted to the current slots
+};
+
+void OptiXDenoiser::selectDevice()
+{
+    if( m_device >= 0 )
+        CUDA_CHECK( cudaSetDevice( m_device ) );
+}
+
+void OptiXDenoiser::createContext()
+{
+    if( m_context )
+        return;
+
+    // Initialize CUDA
+    CUDA_CHECK( cudaFree( nullptr ) );
+
+    CUcontext cu_ctx = nullptr;  // zero means take the current context, i.e. that of m_device
+    OPTIX_CHECK( initOptiX() );
+    OptixDeviceContextOptions options = {};
+    options.logCallbackFunction       = &context_log_cb;
+    options.logCallbackLevel          = 4;
+    OPTIX_CHECK( optixDeviceContextCreate( cu_ctx, &options, &m_context ) );
+
+    CUDA_CHECK( cudaStreamCreateWithFlags( &m_stream, cudaStreamNonBlocking ) );
+}
+
+static bool sameConfiguration( const OptixDenoiserModelKind modelKindA, const OptixDenoiserOptions& optionsA, const DenoiserModel* modelA,
+                               const OptixDenoiserModelKind modelKindB, const OptixDenoiserOptions& optionsB, const DenoiserModel* modelB )
+{
+    if( modelA != modelB )
+        return false;
+    return modelA || ( modelKindA == modelKindB && optionsA.guideAlbedo == optionsB.guideAlbedo
+                       && optionsA.guideNormal == optionsB.guideNormal );
+}
+
+OptixDenoiser OptiXDenoiser::createDenoiser( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options, size_t& modelBytes ) const
+{
+    // OptiX does not report the size of a model; the drop in free device memory is the closest
+    // measure (other users of the device may skew it, so a user model counts at least its size)
+    size_t free_before = 0;
+    size_t free_after  = 0;
+    size_t total       = 0;
+    CUDA_CHECK( cudaMemGetInfo( &free_before, &total ) );
+
+    OptixDenoiser denoiser = nullptr;
+    if( m_userModel )
+        OPTIX_CHECK( optixDenoiserCreateWithUserModel( m_context, m_userModel->data(), m_userModel->size(), &denoiser ) );
+    else
+        OPTIX_CHECK( optixDenoiserCreate( m_context, modelKind, &options, &denoiser ) );
+
+    CUDA_CHECK( cudaMemGetInfo( &free_after, &total ) );
+    modelBytes = free_before > free_after ? free_before - free_after : 0;
+    if( m_userModel )
+        modelBytes = std::max( modelBytes, m_userModel->size() );
+    return denoiser;
+}
+
+bool OptiXDenoiser::denoiserMatches( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options ) const
+{
+    return m_denoiser && sameConfiguration( m_modelKind, m_options, m_denoiserModel.get(), modelKind, options, m_userModel.get() );
+}
+
+void OptiXDenoiser::cacheDenoiser()
+{
+    CachedDenoiser entry;
+    entry.modelKind     = m_modelKind;
+    entry.options       = m_options;
+    entry.model         = m_denoiserModel;
+    entry.denoiser      = m_denoiser;
+    entry.modelBytes    = m_modelBytes;
+    entry.state         = m_state;
+    entry.stateSize     = m_state_size;
+    entry.stateCapacity = m_state_capacity;
+    entry.scratchSize   = m_scratch_size;
+    entry.tileWidth     = m_tileWidth;
+    entry.tileHeight    = m_tileHeight;
+    entry.overlap       = m_overlap;
+    entry.regionOverlap = m_regionOverlap;
+    entry.tiled         = m_tiled;
+    entry.setup         = m_setupKey;
+    m_denoiserCache.push_front( entry );
+    m_setupKey       = SetupKey();
+
+    m_denoiser       = nullptr;
+    m_denoiserModel.reset();
+    m_state          = 0;
+    m_state_size     = 0;
+    m_state_capacity = 0;
+    m_tileWidth      = 0;
+    m_tileHeight     = 0;
+
+    if( m_denoiserCache.size() > kDenoiserCacheSize )
+    {
+        CachedDenoiser& oldest = m_denoiserCache.back();
+        OPTIX_CHECK( optixDenoiserDestroy( oldest.denoiser ) );
+        deviceFree( oldest.state );
+        m_denoiserCache.pop_back();
+    }
+}
+
+bool OptiXDenoiser::restoreDenoiser( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options )
+{
+    for( auto it = m_denoiserCache.begin(); it != m_denoiserCache.end(); ++it )
+    {
+        if( !sameConfiguration( it->modelKind, it->options, it->model.get(), modelKind, options, m_userModel.get() ) )
+            continue;
+        m_modelKind      = it->modelKind;
+        m_options        = it->options;
+        m_denoiserModel  = it->model;
+        m_denoiser       = it->denoiser;
+        m_modelBytes     = it->modelBytes;
+        m_state          = it->state;
+        m_state_size     = it->stateSize;
+        m_state_capacity = it->stateCapacity;
+        m_scratch_size   = it->scratchSize;
+        m_tileWidth      = it->tileWidth;
+        m_tileHeight     = it->tileHeight;
+        m_overlap        = it->overlap;
+        m_regionOverlap  = it->regionOverlap;
+        m_tiled          = it->tiled;
+        m_setupKey       = it->setup;
+        m_denoiserCache.erase( it );
+        return true;
+    }
+    return false;
+}
+
+const OptiXDenoiser::CachedDenoiser* OptiXDenoiser::findCachedDenoiser( OptixDenoiserModelKind modelKind, const OptixDenoiserOptions& options ) const
+{
+    for( const CachedDenoiser& entry : m_denoiserCache )
+    {
+        if( sameConfiguration( entry.modelKind, entry.options, entry.model.get(), modelKind, options, m_userModel.get() ) )
+            return &entry;
+    }
+    return nullptr;
+}
+
+void OptiXDenoiser::releaseDenoiserCache()
+{
+    for( CachedDenoiser& entry : m_denoiserCache )
+    {
+        OPTIX_CHECK( optixDenoiserDestroy( entry.denoiser ) );
+        deviceFree( entry.state );
+    }
+    m_denoiserCache.clear();
+}
+
+DenoiserMemoryRequirements OptiXDenoiser::queryMemoryRequirements( const DenoiserConfig& config )
+{
+    // OptiX reports the sizes only through a denoiser: this creates the device context and
+    // stream on first use (kept for init), and a temporary denoiser unless the configuration's
+    // denoiser is current or cached. No buffers are allocated.
+    selectDevice();
+    createContext();
+
+    DenoiserMemoryRequirements requirements;
+    requirements.onDevice = true;
+    imageRequirements( config, requirements );
+
+    // the sizes depend on the model: ask our denoiser if it matches, a temporary one otherwise
+    OptixDenoiserOptions options = {};
+    options.guideAlbedo = config.albedo ? 1 : 0;
+    options.guideNormal = config.normal ? 1 : 0;
+    const OptixDenoiserModelKind modelKind = denoiserModelKind( config.kpMode, config.aovs, config.temporalMode );
+    OptixDenoiser denoiser = nullptr;
+    if( denoiserMatches( modelKind, options ) )
+    {
+        denoiser           = m_denoiser;
+        requirements.model = m_modelBytes;
+    }
+    else if( const CachedDenoiser* cached = findCachedDenoiser( modelKind, options ) )
+    {
+        denoiser           = cached->denoiser;
+        requirements.model = cached->modelBytes;
+    }
+    const bool temporary = !denoiser;
+    if( temporary )
+        denoiser = createDenoiser( modelKind, options, requirements.model );
+
+    unsigned int tile_w = config.tileWidth;
+    unsigned int tile_h = config.tileHeight;
+    if( tile_w == 0 && m_memoryBudget > 0 )
+    {
+        const size_t image_bytes = requirements.workingSet();
+        chooseTileSize( denoiser, config.width, config.height, m_memoryBudget > image_bytes ? m_memoryBudget - image_bytes : 0, tile_w, tile_h );
+    }
+
+    OptixDenoiserSizes sizes;
+    OPTIX_CHECK( optixDenoiserComputeMemoryResources( denoiser, tile_w ? tile_w : config.width, tile_h ? tile_h : config.height, &sizes ) );
+    // as allocated by init: untiled scratch also covers the offset invocations of execRegion,
+    // and without a budget scratch and state are sized for the bucketed tile
+    requirements.scratch    = tile_w ? sizes.withOverlapScratchSizeInBytes
+                                     : std::max( sizes.withOverlapScratchSizeInBytes, sizes.withoutOverlapScratchSizeInBytes );
+    requirements.state      = sizes.stateSizeInBytes;
+    if( m_memoryBudget == 0 )
+    {
+        OptixDenoiserSizes bucket_sizes;
+        OPTIX_CHECK( optixDenoiserComputeMemoryResources( denoiser, bucketImageDimension( tile_w ? tile_w : config.width ),
+                                                          bucketImageDimension( tile_h ? tile_h : config.height ), &bucket_sizes ) );
+        requirements.scratch = std::max( requirements.scratch, std::max( bucket_sizes.withOverlapScratchSizeInBytes,
+                                                                         bucket_sizes.withoutOverlapScratchSizeInBytes ) );
+        requirements.state   = std::max( requirements.state, bucket_sizes.stateSizeInBytes );
+    }
+    requirements.tileWidth  = tile_w;
+    requirements.tileHeight = tile_h;
+    requirements.overlap    = tile_w ? sizes.overlapWindowSizeInPixels : 0;
+    requirements.regionOverlap = sizes.overlapWindowSizeInPixels;
+
+    if( m_useStaging )
+    {
+        const unsigned int pixel_size = std::max( std::max( pixelSizeInBytes( config.inputFormat ), pixelSizeInBytes( config.guideFormat ) ),
+                                                  std::max( pixelSizeInBytes( config.outputFormat ), unsigned( sizeof( float4 ) ) ) );
+        requirements.host = HostStaging::footprint( size_t( config.width ) * pixel_size );
+    }
+
+    if( temporary )
+        OPTIX_CHECK( optixDenoiserDestroy( denoiser ) );
+    return requirements;
+}
+
+bool OptiXDenoiser::init( const Data&  data,
+                          unsigned int tileWidth,
+                          unsigned int tileHeight,
+                          bool         kpMode,
+                          bool         temporalMode )
+{
+    selectDevice();
+    if( const char* reason = invalidInitReason( data, tileWidth, tileHeight ) )
+    {
+        LOG_ERROR( "Denoiser init failed: %s", reason );
+        return false;
+    }
+    if( temporalMode && ( kpMode || !data.aovs.empty() ) )
+    {
+        LOG_ERROR( "Denoiser init failed: temporal mode does not support AOVs or kernel prediction" );
+        return false;
+    }
+
+    // buffers may be released and handed out again below; unlike cudaFree the arena does not
+    // wait for work still using them
+    wait( m_lastTicket );
+    if( m_stream )
+        CUDA_CHECK( cudaStreamSynchronize( m_stream ) );
+
+    // init may be called again on a live backend (persistent sessions); everything below
+    // only rebuilds the parts whose configuration differs from the previous call.
+    bool denoiser_changed        = false;
+
+    //
+    // Initialize CUDA and create OptiX context
+    //
+    createContext();
+
+    //
+    // Create denoiser
+    //
+    {
+        OptixDenoiserOptions options = {};
+        options.guideAlbedo = data.albedo ? 1 : 0;
+        options.guideNormal = data.normal ? 1 : 0;
+
+        const OptixDenoiserModelKind modelKind = denoiserModelKind( kpMode, data.aovs.size(), temporalMode );
+        SUTIL_ASSERT( modelKind != OPTIX_DENOISER_MODEL_KIND_AOV || !temporalMode );
+
+        if( !denoiserMatches( modelKind, options ) )
+        {
+            if( m_denoiser )
+                cacheDenoiser();
+            if( !restoreDenoiser( modelKind, options ) )
+            {
+                m_denoiser       = createDenoiser( modelKind, options, m_modelBytes );
+                m_modelKind      = modelKind;
+                m_options        = options;
+                m_denoiserModel  = m_userModel;
+                denoiser_changed = true;
+            }
+        }
+    }
+
+    //
+    // Without an explicit tile size, tile as needed to stay within the memory budget
+    //
+    if( tileWidth == 0 && m_memoryBudget > 0 )
+    {
+        DenoiserMemoryRequirements images;
+        imageRequirements( DenoiserConfig( data, 0, 0, kpMode, temporalMode ), images );
+        const size_t image_bytes = images.workingSet();
+        const size_t available   = m_memoryBudget > image_bytes ? m_memoryBudget - image_bytes : 0;
+        if( !chooseTileSize( m_denoiser, data.width, data.height, available, tileWidth, tileHeight ) )
+            LOG_WARNING( "Denoiser memory budget too small, using the smallest tile size" );
+        if( tileWidth > 0 )
+            LOG_INFO( "Denoiser tile size:%ux%u", tileWidth, tileHeight );
+    }
+    const bool tiled             = tileWidth > 0;
+    const unsigned int tile_w    = tiled ? tileWidth : data.width;
+    const unsigned int tile_h    = tiled ? tileHeight : data.height;
+
+    // a fresh session reserves its whole footprint, so that its buffers share one slab
+    if( m_layers.empty() && !m_scratch && !m_state )
+    {
+        const DenoiserMemoryRequirements needed = queryMemoryRequirements( DenoiserConfig( data, tileWidth, tileHeight, kpMode, temporalMode ) );
+        if( !currentDeviceArena().reserve( needed.workingSet() + kArenaHeadroom ) )
+        {
+            LOG_ERROR( "Denoiser init failed: out of device memory" );
+            return false;
+        }
+    }
+
+
+    //
+    // Allocate device memory for denoiser
+    //
+    if( denoiser_changed || tile_w != m_tileWidth || tile_h != m_tileHeight || tiled != m_tiled )
+    {
+        OptixDenoiserSizes denoiser_sizes;
+
+        OPTIX_CHECK( optixDenoiserComputeMemoryResources(
+                    m_denoiser,
+                    tile_w,
+                    tile_h,
+                    &denoiser_sizes
+                    ) );
+
+        // execRegion invokes on windows with input offsets, which needs the overlap scratch
+        // size even when the full image is denoised in one piece
+        if( !tiled )
+        {
+            m_scratch_size = static_cast<uint32_t>( std::max( denoiser_sizes.withoutOverlapScratchSizeInBytes,
+                                                              denoiser_sizes.withOverlapScratchSizeInBytes ) );
+            m_overlap = 0;
+        }
+        else
+        {
+            m_scratch_size = static_cast<uint32_t>( denoiser_sizes.withOverlapScratchSizeInBytes );
+            m_overlap = denoiser_sizes.overlapWindowSizeInPixels;
+        }
+
+        m_state_size    = static_cast<uint32_t>( denoiser_sizes.stateSizeInBytes );
+        m_regionOverlap = denoiser_sizes.overlapWindowSizeInPixels;
+
+        // grow scratch and state to the sizes needed by the bucketed tile, so that
+        // resizing within the bucket does not reallocate; under a memory budget only the
+        // exact sizes are allocated
+        if( m_scratch_size > m_scratch_capacity || m_state_size > m_state_capacity )
+        {
+            OptixDenoiserSizes bucket_sizes = denoiser_sizes;
+            if( m_memoryBudget == 0 )
+            {
+                OPTIX_CHECK( optixDenoiserComputeMemoryResources(
+                            m_denoiser,
+                            bucketImageDimension( tile_w ),
+                            bucketImageDimension( tile_h ),
+                            &bucket_sizes
+                            ) );
+            }
+
+            if( m_scratch_size > m_scratch_capacity )
+            {
+                m_scratch_capacity = std::max<size_t>( m_scratch_size, std::max( bucket_sizes.withOverlapScratchSizeInBytes,
+                                                                                 bucket_sizes.withoutOverlapScratchSizeInBytes ) );
+                deviceFree( m_scratch );
+                m_scratch = deviceAlloc( m_scratch_capacity );
+            }
+
+            if( m_state_size > m_state_capacity )
+            {
+                m_state_capacity = std::max<size_t>( m_state_size, bucket_sizes.stateSizeInBytes );
+                deviceFree( m_state );
+                m_state = deviceAlloc( m_state_capacity );
+            }
+        }
+        m_tileWidth  = tile_w;
+        m_tileHeight = tile_h;
+        m_tiled      = tiled;
+    }
+    else if( m_scratch_size > m_scratch_capacity )
+    {
+        // a restored denoiser may need more scratch than the one it replaced
+        m_scratch_capacity = m_scratch_size;
+        deviceFree( m_scratch );
+        m_scratch = deviceAlloc( m_scratch_capacity );
+    }
+
+    if( data.aovs.size() == 0 && kpMode == false )
+    {
+        if( !m_intensity )
+            m_intensity = deviceAlloc( sizeof( float ) );
+        deviceFree( m_avgColor );
+        m_avgColor = 0;
+    }
+    else
+    {
+        if( !m_avgColor )
+            m_avgColor = deviceAlloc( 3 * sizeof( float ) );
+        deviceFree( m_intensity );
+        m_intensity = 0;
+    }
+
+    //
+    // Allocate image buffers, or reuse them if the layer set is unchanged and the new
+    // resolution fits into the current allocation bucket
+    //
+    const bool same_images = !m_layers.empty()
+        && data.width <= m_allocWidth && data.height <= m_allocHeight
+        && data.aovs.size() + 1 == m_layers.size()
+        && ( data.albedo != nullptr ) == ( m_guideLayer.albedo.data != 0 )
+        && ( data.normal != nullptr ) == ( m_guideLayer.normal.data != 0 )
+        && temporalMode == m_temporalMode
+        && data.colorOnDevice == m_colorOnDevice && data.albedoOnDevice == m_albedoOnDevice
+        && data.normalOnDevice == m_normalOnDevice && data.outputOnDevice == m_outputOnDevice
+        && data.inputFormat == m_inputFormat && data.guideFormat == m_guideFormat
+        && data.outputFormat == m_outputFormat;
+
+    m_temporalMode = temporalMode;
+
+    if( same_images )
+    {
+        // the pipeline slots share the allocation bucket and are kept as well
+        resizeImages( data.width, data.height );
+        resizeSlots( data.width, data.height );
+    }
+    else
+    {
+        // pipeline slots are rebuilt for the new configuration on the next submitFrame
+        releaseSlots();
+        releaseImages();
+
+        m_colorOnDevice  = data.colorOnDevice;
+        m_albedoOnDevice = data.albedoOnDevice;
+        m_normalOnDevice = data.normalOnDevice;
+        m_outputOnDevice = data.outputOnDevice;
+        m_inputFormat    = data.inputFormat;
+        m_guideFormat    = data.guideFormat;
+        m_outputFormat   = data.outputFormat;
+
+        m_allocWidth  = std::max( bucketImageDimension( data.width ), m_allocWidth );
+        m_allocHeight = std::max( bucketImageDimension( data.height ), m_allocHeight );
+        const unsigned int aw = m_allocWidth;
+        const unsigned int ah = m_allocHeight;
+
+        // host images are filled and device images bound by the update below
+        OptixDenoiserLayer layer = {};
+        layer.input  = m_colorOnDevice ? wrapOptixImage2D( data, data.color, data.inputLayout, m_inputFormat )
+                                       : createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream, m_inputFormat );
+        layer.output = m_outputOnDevice ? wrapOptixImage2D( data, data.outputs[0], data.outputLayout, m_outputFormat )
+                                        : createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream, m_outputFormat );
+        if( m_temporalMode )
+            m_guideLayer.flow = createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream );
+        m_layers.push_back( layer );
+
+        if( data.albedo )
+            m_guideLayer.albedo = m_albedoOnDevice ? wrapOptixImage2D( data, data.albedo, data.inputLayout, m_guideFormat )
+                                                   : createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream, m_guideFormat );
+        if( data.normal )
+            m_guideLayer.normal = m_normalOnDevice ? wrapOptixImage2D( data, data.normal, data.inputLayout, m_guideFormat )
+                                                   : createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream, m_guideFormat );
+
+        for( size_t i=0; i < data.aovs.size(); i++ )
+        {
+            layer.input  = createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream, m_inputFormat );
+            layer.output = createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream, m_outputFormat );
+            m_layers.push_back( layer );
+        }
+
+        if( m_temporalMode )
+        {
+            for( size_t i=0; i < m_layers.size(); i++ )
+                m_history.push_back( createOptixImage2D( data.width, data.height, nullptr, aw, ah, m_stream, m_outputFormat ) );
+        }
+    }
+
+    if( !workingMemoryAllocated( data ) )
+    {
+        LOG_ERROR( "Denoiser init failed: out of device memory" );
+        releaseWorkingMemory();
+        return false;
+    }
+
+    update( data );
+    if( m_temporalMode )
+    {
+        // first frame of a sequence: zero motion and no history
+        CUDA_CHECK( cudaMemsetAsync( reinterpret_cast<void*>( m_guideLayer.flow.data ), 0, size_t( m_guideLayer.flow.rowStrideInBytes ) * m_allocHeight, m_stream ) );
+        for( size_t i=0; i < m_layers.size(); i++ )
+            m_layers[i].previousOutput = m_layers[i].input;
+        m_historyValid = false;
+    }
+
+    //
+    // Setup denoiser, unless the state is still set up for this denoiser and tile size (re-init
+    // at the same size, or a cached denoiser restored)
+    //
+    SetupKey setup;
+    setup.denoiser    = m_denoiser;
+    setup.inputWidth  = m_tileWidth + 2 * m_overlap;
+    setup.inputHeight = m_tileHeight + 2 * m_overlap;
+    setup.state       = m_state;
+    setup.stateSize   = m_state_size;
+    setup.scratchSize = m_scratch_size;
+    if( !( setup == m_setupKey ) )
+    {
+        OPTIX_CHECK( optixDenoiserSetup(
+                    m_denoiser,
+                    m_stream,
+                    m_tileWidth + 2 * m_overlap,
+                    m_tileHeight + 2 * m_overlap,
+                    m_state,
+                    m_state_size,
+                    m_scratch,
+                    m_scratch_size
+                    ) );
+        m_setupKey = setup;
+    }
+
+    m_params.denoiseAlpha    = 0;
+    m_params.hdrIntensity    = m_intensity;
+    m_params.hdrAverageColor = m_avgColor;
+    m_params.blendFactor     = 0.0f;
+    return true;
+}
+
+void OptiXDenoiser::update( const Data& data )
+{
+    selectDevice();
+    SUTIL_ASSERT_MSG( !data.normal || data.albedo, "Currently albedo is required if normal input is given" );
+
+    // the device images keep the size, layers and guides of init; a new size needs a new init
+    if( m_layers.empty() || !data.color || data.outputs.empty() || !data.outputs[0]
+        || data.width != m_layers[0].input.width || data.height != m_layers[0].input.height
+        || data.aovs.size() + 1 != m_layers.size()
+        || ( data.albedo != nullptr ) != ( m_guideLayer.albedo.data != 0 )
+        || ( data.normal != nullptr ) != ( m_guideLayer.normal.data != 0 )
+        || data.colorOnDevice != m_colorOnDevice || data.outputOnDevice != m_outputOnDevice
+        || data.albedoOnDevice != m_albedoOnDevice || data.normalOnDevice != m_normalOnDevice )
+    {
+        LOG_ERROR( "Denoiser update skipped: the data does not match the last init" );
+        return;
+    }
+
+    ScopedStageTimer timer( m_timings, DenoiserStage::Upload );
+    setHostOutputs( data );
+
+    const DenoiserImageLayout& in = data.inputLayout;
+    const size_t input_pitch = in.rowStrideInBytes( data.width, m_inputFormat );
+    const size_t guide_pitch = in.rowStrideInBytes( data.width, m_guideFormat );
+
+    // device images are only rebound, the caller may pass different buffers every frame
+    if( m_colorOnDevice )
+        m_layers[0].input = wrapOptixImage2D( data, data.color, in, m_inputFormat );
+    else
+        upload( m_layers[0].input, in.regionStart( data.color, data.width, m_inputFormat ), input_pitch );
+    if( m_outputOnDevice )
+        m_layers[0].output = wrapOptixImage2D( data, data.outputs[0], data.outputLayout, m_outputFormat );
+
+    // the history is bound by exec, see advanceHistory. No flow means no motion, not the
+    // previous frame's vectors.
+    if( m_temporalMode && data.flow )
+        upload( m_guideLayer.flow, in.regionStart( data.flow, data.width, DenoiserPixelFormat::Float4 ),
+                in.rowStrideInBytes( data.width, DenoiserPixelFormat::Float4 ) );
+    else if( m_temporalMode )
+        CUDA_CHECK( cudaMemsetAsync( reinterpret_cast<void*>( m_guideLayer.flow.data ), 0,
+                                     size_t( m_guideLayer.flow.rowStrideInBytes ) * m_guideLayer.flow.height, m_stream ) );
+
+    if( data.albedo && m_albedoOnDevice )
+        m_guideLayer.albedo = wrapOptixImage2D( data, data.albedo, in, m_guideFormat );
+    else if( data.albedo )
+        upload( m_guideLayer.albedo, in.regionStart( data.albedo, data.width, m_guideFormat ), guide_pitch );
+
+    if( data.normal && m_normalOnDevice )
+        m_guideLayer.normal = wrapOptixImage2D( data, data.normal, in, m_guideFormat );
+    else if( data.normal )
+        upload( m_guideLayer.normal, in.regionStart( data.normal, data.width, m_guideFormat ), guide_pitch );
+
+    for( size_t i=0; i < data.aovs.size(); i++ )
+        upload( m_layers[i+1].input, in.regionStart( data.aovs[i], data.width, m_inputFormat ), input_pitch );
+
+    // the caller may reuse its host buffers once update returns
+    CUDA_CHECK( cudaStreamSynchronize( m_stream ) );
+}
+
+void OptiXDenoiser::exec()
+{
+    selectDevice();
+    wait( execAsync() );
+}
+
+void OptiXDenoiser::computeExposure( const OptixImage2D& color )
+{
+    if( m_exposureFixed )
+    {
+        // pageable source: the copy is staged before cudaMemcpyAsync returns
+        if( m_intensity )
+            CUDA_CHECK( cudaMemcpyAsync( reinterpret_cast<void*>( m_intensity ), &m_exposure.intensity, sizeof( float ),
+                                         cudaMemcpyHostToDevice, m_stream ) );
+        if( m_avgColor )
+            CUDA_CHECK( cudaMemcpyAsync( reinterpret_cast<void*>( m_avgColor ), m_exposure.averageColor, 3 * sizeof( float ),
+                                         cudaMemcpyHostToDevice, m_stream ) );
+        return;
+    }
+    if( m_intensity )
+    {
+        OPTIX_CHECK( optixDenoiserComputeIntensity(
+                    m_denoiser,
+                    m_stream,
+                    &color,
+                    m_intensity,
+                    m_scratch,
+                    m_scratch_size
+                    ) );
+    }
+    if( m_avgColor )
+    {
+        OPTIX_CHECK( optixDenoiserComputeAverageColor(
+                    m_denoiser,
+                    m_stream,
+                    &color,
+                    m_avgColor,
+                    m_scratch,
+                    m_scratch_size
+                    ) );
+    }
+}
+
+void OptiXDenoiser::setExposure( const DenoiserExposure* exposure )
+{
+    m_exposureFixed = exposure != nullptr;
+    if( exposure )
+        m_exposure = *exposure;
+}
+
+void OptiXDenoiser::advanceHistory()
+{
+    for( size_t i=0; i < m_layers.size(); i++ )
+    {
+        OptixDenoiserLayer& layer = m_layers[i];
+        if( !m_historyValid )
+        {
+            layer.previousOutput = layer.input;     // first frame of a sequence
+            continue;
+        }
+        // the last result becomes the history and its history buffer the new output
+        if( i > 0 || !m_outputOnDevice )
+            std::swap( layer.output, m_history[i] );
+        layer.previousOutput = m_history[i];
+    }
+}
+
+uint64_t OptiXDenoiser::execAsync()
+{
+    selectDevice();
+    if( m_temporalMode )
+        advanceHistory();
+
+    Ticket ticket;
+    ticket.id      = ++m_lastTicket;
+    ticket.start   = acquireEvent();
+    ticket.invoke  = acquireEvent();
+    ticket.invoked = acquireEvent();
+    ticket.done    = acquireEvent();
+    CUDA_CHECK( cudaEventRecord( ticket.start, m_stream ) );
+
+    computeExposure( m_layers[0].input );
+
+    /**
+    OPTIX_CHECK( optixDenoiserInvoke(
+                m_denoiser,
+                nullptr, // CUDA stream
+                &m_params,
+                m_state,
+                m_state_size,
+                &m_guideLayer,
+                m_layers.data(),
+                static_cast<unsigned int>( m_layers.size() ),
+                0, // input offset X
+                0, // input offset y
+                m_scratch,
+                m_scratch_size
+                ) );
+    **/
+    CUDA_CHECK( cudaEventRecord( ticket.invoke, m_stream ) );
+    OPTIX_CHECK( optixUtilDenoiserInvokeTiled(
+                m_denoiser,
+                m_stream,
+                &m_params,
+                m_state,
+                m_state_size,
+                &m_guideLayer,
+                m_layers.data(),
+                static_cast<unsigned int>( m_layers.size() ),
+                m_scratch,
+                m_scratch_size,
+                m_overlap,
+                m_tileWidth,
+                m_tileHeight
+                ) );
+    CUDA_CHECK( cudaEventRecord( ticket.invoked, m_stream ) );
+
+    if( m_temporalMode )
+    {
+        // a caller owned output may be overwritten before the next frame, keep a copy
+        if( m_outputOnDevice )
+        {
+            const OptixImage2D& output = m_layers[0].output;
+            CUDA_CHECK( cudaMemcpy2DAsync( reinterpret_cast<void*>( m_history[0].data ), m_history[0].rowStrideInBytes,
+                                           reinterpret_cast<const void*>( output.data ), output.rowStrideInBytes,
+                                           size_t( output.width ) * output.pixelStrideInBytes, output.height,
+                                           cudaMemcpyDeviceToDevice, m_stream ) );
+        }
+        m_historyValid = true;
+    }
+
+    CUDA_CHECK( cudaEventRecord( ticket.done, m_stream ) );
+
+    m_inFlight.push_back( ticket );
+    return ticket.id;
+}
+
+cudaEvent_t OptiXDenoiser::acquireEvent()
+{
+    cudaEvent_t event;
+    if( m_freeEvents.empty() )
+    {
+        CUDA_CHECK( cudaEventCreateWithFlags( &event, cudaEventDefault ) );
+    }
+    else
+    {
+        event = m_freeEvents.back();
+        m_freeEvents.pop_back();
+    }
+    return event;
+}
+
+void OptiXDenoiser::retireTicket()
+{
+    const Ticket& ticket = m_inFlight.front();
+    float intensity = 0.f;
+    float invoke    = 0.f;
+    CUDA_CHECK( cudaEventElapsedTime( &intensity, ticket.start, ticket.invoke ) );
+    CUDA_CHECK( cudaEventElapsedTime( &invoke, ticket.invoke, ticket.invoked ) );
+    m_timings.record( DenoiserStage::Intensity, intensity );
+    m_timings.record( DenoiserStage::Invoke, invoke );
+
+    m_completedTicket = ticket.id;
+    const cudaEvent_t events[] = { ticket.start, ticket.invoke, ticket.invoked, ticket.done };
+    m_freeEvents.insert( m_freeEvents.end(), events, events + 4 );
+    m_inFlight.pop_front();
+}
+
+bool OptiXDenoiser::poll( uint64_t ticket )
+{
+    selectDevice();
+    // tickets complete in order, so only the oldest ones need to be queried
+    while( !m_inFlight.empty() )
+    {
+        const cudaError_t status = cudaEventQuery( m_inFlight.front().done );
+        if( status == cudaErrorNotReady )
+            break;
+        CUDA_CHECK( status );
+        retireTicket();
+    }
+    return ticket <= m_completedTicket;
+}
+
+void OptiXDenoiser::wait( uint64_t ticket )
+{
+    selectDevice();
+    ScopedStageTimer timer( m_timings, DenoiserStage::Wait );
+    if( m_inFlight.empty() || m_inFlight.front().id > ticket )
+        timer.cancel();
+    while( !m_inFlight.empty() && m_inFlight.front().id <= ticket )
+    {
+        CUDA_CHECK( cudaEventSynchronize( m_inFlight.front().done ) );
+        retireTicket();
+    }
+}
+
+StageStatistics OptiXDenoiser::stageStatistics( DenoiserStage stage )
+{
+    // pick up the device times of tickets that completed without being polled
+    poll( 0 );
+    return m_timings.statistics( stage );
+}
+
+void OptiXDenoiser::resetStageTimings()
+{
+    m_timings.reset();
+}
+
+void OptiXDenoiser::execRegion( const Data& data, unsigned int x, unsigned int y, unsigned int width, unsigned int height )
+{
+    selectDevice();
+    SUTIL_ASSERT_MSG( !m_temporalMode, "region denoising is not available in temporal mode" );
+    if( m_temporalMode || m_layers.empty() )
+        return;
+    const unsigned int image_w = m_layers[0].input.width;
+    const unsigned int image_h = m_layers[0].input.height;
+    SUTIL_ASSERT( data.width == image_w && data.height == image_h );
+    if( data.width != image_w || data.height != image_h || x >= image_w || y >= image_h )
+        return;
+    width  = std::min( width, image_w - x );
+    height = std::min( height, image_h - y );
+
+    wait( m_lastTicket );
+    setHostOutputs( data );
+
+    //
+    // refresh the inputs of the rectangle plus its overlap; device images are only rebound
+    //
+    const unsigned int margin = m_regionOverlap;
+    const unsigned int wx = x > margin ? x - margin : 0;
+    const unsigned int wy = y > margin ? y - margin : 0;
+    const unsigned int ww = std::min( x + width + margin, image_w ) - wx;
+    const unsigned int wh = std::min( y + height + margin, image_h ) - wy;
+
+    const DenoiserImageLayout& in = data.inputLayout;
+    const size_t input_pitch = in.rowStrideInBytes( data.width, m_inputFormat );
+    const size_t guide_pitch = in.rowStrideInBytes( data.width, m_guideFormat );
+
+    if( m_colorOnDevice )
+        m_layers[0].input = wrapOptixImage2D( data, data.color, in, m_inputFormat );
+    else
+        upload( subImage2D( m_layers[0].input, wx, wy, ww, wh ),
+                hostPixel( in.regionStart( data.color, data.width, m_inputFormat ), input_pitch, m_inputFormat, wx, wy ), input_pitch );
+    if( m_outputOnDevice )
+        m_layers[0].output = wrapOptixImage2D( data, data.outputs[0], data.outputLayout, m_outputFormat );
+    for( size_t i=0; i < data.aovs.size() && i + 1 < m_layers.size(); i++ )
+        upload( subImage2D( m_layers[i+1].input, wx, wy, ww, wh ),
+                hostPixel( in.regionStart( data.aovs[i], data.width, m_inputFormat ), input_pitch, m_inputFormat, wx, wy ), input_pitch );
+
+    if( data.albedo && m_albedoOnDevice )
+        m_guideLayer.albedo = wrapOptixImage2D( data, data.albedo, in, m_guideFormat );
+    else if( data.albedo && m_guideLayer.albedo.data )
+        upload( subImage2D( m_guideLayer.albedo, wx, wy, ww, wh ),
+                hostPixel( in.regionStart( data.albedo, data.width, m_guideFormat ), guide_pitch, m_guideFormat, wx, wy ), guide_pitch );
+    if( data.normal && m_normalOnDevice )
+        m_guideLayer.normal = wrapOptixImage2D( data, data.normal, in, m_guideFormat );
+    else if( data.normal && m_guideLayer.normal.data )
+        upload( subImage2D( m_guideLayer.normal, wx, wy, ww, wh ),
+                hostPixel( in.regionStart( data.normal, data.width, m_guideFormat ), guide_pitch, m_guideFormat, wx, wy ), guide_pitch );
+
+    // exposure of the whole frame, so the region matches its surroundings
+    computeExposure( m_layers[0].input );
+
+    //
+    // invoke per tile of the rectangle (a single one unless tiling is enabled); each input
+    // window reaches margin pixels beyond its tile, and only the tile is written
+    //
+    const unsigned int tile_w = m_tiled ? m_tileWidth : image_w;
+    const unsigned int tile_h = m_tiled ? m_tileHeight : image_h;
+    std::vector< OptixDenoiserLayer > layers( m_layers.size() );
+    for( unsigned int ty = y; ty < y + height; ty += tile_h )
+    {
+        for( unsigned int tx = x; tx < x + width; tx += tile_w )
+        {
+            const unsigned int tw = std::min( tile_w, x + width - tx );
+            const unsigned int th = std::min( tile_h, y + height - ty );
+            const unsigned int ix = tx > margin ? tx - margin : 0;
+            const unsigned int iy = ty > margin ? ty - margin : 0;
+            const unsigned int iw = std::min( tx + tw + margin, image_w ) - ix;
+            const unsigned int ih = std::min( ty + th + margin, image_h ) - iy;
+
+            OptixDenoiserGuideLayer guide_layer = {};
+            guide_layer.albedo = subImage2D( m_guideLayer.albedo, ix, iy, iw, ih );
+            guide_layer.normal = subImage2D( m_guideLayer.normal, ix, iy, iw, ih );
+            for( size_t i=0; i < m_layers.size(); i++ )
+            {
+                layers[i]        = OptixDenoiserLayer();
+                layers[i].input  = subImage2D( m_layers[i].input, ix, iy, iw, ih );
+                layers[i].output = subImage2D( m_layers[i].output, tx, ty, tw, th );
+            }
+
+            OPTIX_CHECK( optixDenoiserInvoke(
+                        m_denoiser,
+                        m_stream,
+                        &m_params,
+                        m_state,
+                        m_state_size,
+                        &guide_layer,
+                        layers.data(),
+                        static_cast<unsigned int>( layers.size() ),
+                        tx - ix,
+                        ty - iy,
+                        m_scratch,
+                        m_scratch_size
+                        ) );
+        }
+    }
+
+    //
+    // merge the rectangle into the host outputs; a device output already holds it
+    //
+    for( size_t i = m_outputOnDevice ? 1 : 0; i < m_layers.size() && i < m_host_outputs.size(); i++ )
+        download( hostPixel( m_host_outputs[i], m_outputRowStride, m_outputFormat, x, y ), m_outputRowStride,
+                  subImage2D( m_layers[i].output, x, y, width, height ) );
+    CUDA_CHECK( cudaStreamSynchronize( m_stream ) );
+}
+
+void OptiXDenoiser::getFlowResults()
+{
+    selectDevice();
+    if( m_layers.size() == 0 )
+        return;
+
+    if( !m_guideLayer.flow.data )
+        return;
+
+    // one buffer, kept between calls: the flow, then the input and the result of every layer
+    const unsigned int width  = m_layers[0].input.width;
+    const unsigned int height = m_layers[0].input.height;
+    const size_t       pixels = size_t( width ) * height;
+    const size_t       layers = m_layers.size();
+    m_warpBuffer.resize( ( 1 + 2 * layers ) * pixels );
+    m_warpRaw.resize( pixels * pixelSizeInBytes( m_inputFormat ) );
+
+    float4* flow = m_warpBuffer.data();
+    downloadOptixImage2D( reinterpret_cast<float*>( flow ), m_guideLayer.flow, m_stream );
+    std::vector< float4* >       results( layers );
+    std::vector< const float4* > images( layers );
+    for( size_t i=0; i < layers; i++ )
+    {
+        float4* image = m_warpBuffer.data() + ( 1 + i ) * pixels;
+        downloadOptixImage2D( reinterpret_cast<float*>( m_warpRaw.data() ), m_layers[i].input, m_stream );
+        CUDA_CHECK( cudaStreamSynchronize( m_stream ) );
+        convertToFloat4( image, m_warpRaw.data(), m_inputFormat, pixels );
+        images[i]  = image;
+        results[i] = m_warpBuffer.data() + ( 1 + layers + i ) * pixels;
+    }
+
+    warpImages( results.data(), images.data(), layers, flow, width, height );
+
+    for( size_t i=0; i < layers && i < m_host_outputs.size(); i++ )
+        convertImageFromFloat4( m_host_outputs[i], m_outputRowStride, results[i], m_outputFormat, width, height );
+}
+
+void OptiXDenoiser::getResults()
+{
+    selectDevice();
+    // the downloads are ordered after the denoise anyway; waiting first keeps its time out of Download
+    wait( m_lastTicket );
+    ScopedStageTimer timer( m_timings, DenoiserStage::Download );
+    // a device output already holds the result, it only has to be complete
+    for( size_t i = m_outputOnDevice ? 1 : 0; i < m_layers.size(); i++ )
+        download( m_host_outputs[i], m_outputRowStride, m_layers[i].output );
+    CUDA_CHECK( cudaStreamSynchronize( m_stream ) );
+}
+
+void OptiXDenoiser::upload( const OptixImage2D& dst, const float* src, size_t pitch )
+{
+    if( m_useStaging && !isPinnedHostPointer( src ) )
+        m_staging.upload( dst, src, pitch, m_stream );
+    else
+        uploadOptixImage2D( dst, src, m_stream, cudaMemcpyHostToDevice, pitch );
+}
+
+void OptiXDenoiser::download( float* dst, size_t pitch, const OptixImage2D& src )
+{
+    if( m_useStaging && !isPinnedHostPointer( dst ) )
+        m_staging.download( dst, pitch, src, m_stream );
+    else
+        downloadOptixImage2D( dst, src, m_stream, pitch );
+}
+
+void OptiXDenoiser::setHostOutputs( const Data& data )
+{
+    m_outputRowStride = data.outputLayout.rowStrideInBytes( data.width, data.outputFormat );
+    m_host_outputs.resize( data.outputs.size() );
+    for( size_t i=0; i < data.outputs.size(); i++ )
+        m_host_outputs[i] = data.outputLayout.regionStart( data.outputs[i], data.width, data.outputFormat );
+}
+
+void OptiXDenoiser::setPipelineDepth( unsigned int depth )
+{
+    selectDevice();
+    depth = std::min( std::max( depth, 1u ), 3u );
+    if( depth == m_pipelineDepth )
+        return;
+    releaseSlots();
+    m_pipelineDepth = depth;
+}
+
+bool OptiXDenoiser::createSlot( FrameSlot& slot )
+{
+    const unsigned int width  = m_layers[0].input.width;
+    const unsigned int height = m_layers[0].input.height;
+    // host buffers hold the whole bucket, so that resizeSlots never reallocates them
+    const size_t       output_byte_size = size_t( m_allocWidth ) * m_allocHeight * pixelSizeInBytes( m_outputFormat );
+
+    for( size_t i=0; i < m_layers.size(); i++ )
+    {
+        OptixDenoiserLayer layer = {};
+        layer.input  = createOptixImage2D( width, height, nullptr, m_allocWidth, m_allocHeight, nullptr, m_inputFormat );
+        layer.output = createOptixImage2D( width, height, nullptr, m_allocWidth, m_allocHeight, nullptr, m_outputFormat );
+        slot.layers.push_back( layer );
+
+        float* output = nullptr;
+        CUDA_CHECK( cudaHostAlloc( reinterpret_cast<void**>( &output ), output_byte_size, cudaHostAllocDefault ) );
+        slot.hostOutputs.push_back( output );
+    }
+    if( m_guideLayer.albedo.data )
+        slot.guideLayer.albedo = createOptixImage2D( width, height, nullptr, m_allocWidth, m_allocHeight, nullptr, m_guideFormat );
+    if( m_guideLayer.normal.data )
+        slot.guideLayer.normal = createOptixImage2D( width, height, nullptr, m_allocWidth, m_allocHeight, nullptr, m_guideFormat );
+    if( m_temporalMode )
+        slot.guideLayer.flow = createOptixImage2D( width, height, nullptr, m_allocWidth, m_allocHeight );
+
+    // one staging buffer per input image: layers, then albedo, normal, flow
+    slot.hostInputs.assign( m_layers.size() + 3, nullptr );
+
+    CUDA_CHECK( cudaEventCreateWithFlags( &slot.uploaded, cudaEventDisableTiming ) );
+    CUDA_CHECK( cudaEventCreateWithFlags( &slot.denoised, cudaEventDisableTiming ) );
+    CUDA_CHECK( cudaEventCreateWithFlags( &slot.readBack, cudaEventDisableTiming ) );
+
+    for( size_t i=0; i < slot.layers.size(); i++ )
+    {
+        if( !slot.layers[i].input.data || !slot.layers[i].output.data || !slot.hostOutputs[i] )
+            return false;
+    }
+    if( ( m_guideLayer.albedo.data && !slot.guideLayer.albedo.data ) || ( m_guideLayer.normal.data && !slot.guideLayer.normal.data )
+        || ( m_temporalMode && !slot.guideLayer.flow.data ) )
+        return false;
+    return true;
+}
+
+void OptiXDenoiser::releaseSlots()
+{
+    for( size_t s=0; s < m_slots.size(); s++ )
+    {
+        FrameSlot& slot = m_slots[s];
+        if( !slot.readBack )
+            continue;   // never created, see submitFrame
+        CUDA_CHECK( cudaEventSynchronize( slot.readBack ) );
+
+        for( size_t i=0; i < slot.layers.size(); i++ )
+        {
+            deviceFree( slot.layers[i].input.data );
+            deviceFree( slot.layers[i].output.data );
+        }
+        deviceFree( slot.guideLayer.albedo.data );
+        deviceFree( slot.guideLayer.normal.data );
+        deviceFree( slot.guideLayer.flow.data );
+        for( size_t i=0; i < slot.hostInputs.size(); i++ )
+            if( slot.hostInputs[i] )
+                CUDA_CHECK( cudaFreeHost( slot.hostInputs[i] ) );
+        for( size_t i=0; i < slot.hostOutputs.size(); i++ )
+            CUDA_CHECK( cudaFreeHost( slot.hostOutputs[i] ) );
+
+        CUDA_CHECK( cudaEventDestroy( slot.uploaded ) );
+        CUDA_CHECK( cudaEventDestroy( slot.denoised ) );
+        CUDA_CHECK( cudaEventDestroy( slot.readBack ) );
+    }
+    m_slots.clear();
+}
+
+void OptiXDenoiser::resizeSlots( unsigned int width, unsigned int height )
+{
+    for( size_t s=0; s < m_slots.size(); s++ )
+    {
+        FrameSlot& slot = m_slots[s];
+        if( !slot.readBack )
+            continue;
+        CUDA_CHECK( cudaEventSynchronize( slot.readBack ) );
+
+        OptixImage2D* images[] = { &slot.guideLayer.albedo, &slot.guideLayer.normal, &slot.guideLayer.flow };
+        for( OptixImage2D* oi : images )
+        {
+            oi->width  = width;
+            oi->height = height;
+        }
+        for( size_t i=0; i < slot.layers.size(); i++ )
+        {
+            slot.layers[i].input.width   = width;
+            slot.layers[i].input.height  = height;
+            slot.layers[i].output.width  = width;
+            slot.layers[i].output.height = height;
+        }
+        // results of the previous size are gone
+        slot.id = 0;
+    }
+    // a resized sequence starts without history
+    m_firstSlotFrame = m_lastFrame + 1;
+}
+
+void OptiXDenoiser::uploadSlotImage( FrameSlot& slot, size_t input, const OptixImage2D& dst, const float* src, size_t pitch, bool onDevice )
+{
+    if( onDevice )
+    {
+        // still copied: the caller may overwrite its buffer while the frame is in flight
+        uploadOptixImage2D( dst, src, m_uploadStream, cudaMemcpyDeviceToDevice, pitch );
+        return;
+    }
+    if( !isPinnedHostPointer( src ) )
+    {
+        const size_t row_bytes = size_t( dst.width ) * dst.pixelStrideInBytes;
+        if( !slot.hostInputs[input] )
+        {
+            // sized for the whole bucket, like the slot's host outputs
+            const size_t byte_size = size_t( m_allocWidth ) * m_allocHeight * dst.pixelStrideInBytes;
+            CUDA_CHECK( cudaHostAlloc( reinterpret_cast<void**>( &slot.hostInputs[input] ), byte_size, cudaHostAllocDefault ) );
+        }
+        copyImageRows( slot.hostInputs[input], row_bytes, src, pitch, row_bytes, dst.height );
+        src   = slot.hostInputs[input];
+        pitch = row_bytes;
+    }
+    uploadOptixImage2D( dst, src, m_uploadStream, cudaMemcpyHostToDevice, pitch );
+}
+
+uint64_t OptiXDenoiser::submitFrame( const Data& data )
+{
+    selectDevice();
+    SUTIL_ASSERT( data.color  );
+    SUTIL_ASSERT_MSG( !data.normal || data.albedo, "Currently albedo is required if normal input is given" );
+
+    if( m_layers.empty() || data.width != m_layers[0].input.width || data.height != m_layers[0].input.height )
+        return 0;
+
+    if( m_slots.empty() )
+    {
+        if( !m_uploadStream )
+            CUDA_CHECK( cudaStreamCreateWithFlags( &m_uploadStream, cudaStreamNonBlocking ) );
+        if( !m_downloadStream )
+            CUDA_CHECK( cudaStreamCreateWithFlags( &m_downloadStream, cudaStreamNonBlocking ) );
+
+        // temporal frames read the previous slot's output, which must not be the slot being written
+        m_slots.resize( m_temporalMode ? std::max( m_pipelineDepth, 2u ) : m_pipelineDepth );
+        bool created = true;
+        for( size_t s=0; s < m_slots.size() && created; s++ )
+            created = createSlot( m_slots[s] );
+        if( !created )
+        {
+            LOG_ERROR( "Denoiser frame slots could not be allocated: out of device memory" );
+            releaseSlots();
+            return 0;
+        }
+        m_firstSlotFrame = m_lastFrame + 1;
+    }
+
+    // the first frame of a sequence has no history
+    FrameSlot* previous = m_lastFrame >= m_firstSlotFrame ? &m_slots[( m_lastFrame - 1 ) % m_slots.size()] : nullptr;
+    FrameSlot& slot = m_slots[m_lastFrame % m_slots.size()];
+
+    // the slot is free once its previous frame has been read back; this also means the
+    // staging buffers are no longer read by the upload stream
+    CUDA_CHECK( cudaEventSynchronize( slot.readBack ) );
+    slot.id = ++m_lastFrame;
+
+    //
+    // upload
+    //
+    const size_t guides = slot.layers.size();
+    const DenoiserImageLayout& in = data.inputLayout;
+    const DenoiserPixelFormat  flow_format = DenoiserPixelFormat::Float4;
+    const size_t input_pitch = in.rowStrideInBytes( data.width, m_inputFormat );
+    const size_t guide_pitch = in.rowStrideInBytes( data.width, m_guideFormat );
+    uploadSlotImage( slot, 0, slot.layers[0].input, in.regionStart( data.color, data.width, m_inputFormat ), input_pitch, data.colorOnDevice );
+    for( size_t i=0; i < data.aovs.size() && i + 1 < slot.layers.size(); i++ )
+        uploadSlotImage( slot, i + 1, slot.layers[i + 1].input, in.regionStart( data.aovs[i], data.width, m_inputFormat ), input_pitch, false );
+    if( data.albedo && slot.guideLayer.albedo.data )
+        uploadSlotImage( slot, guides, slot.guideLayer.albedo, in.regionStart( data.albedo, data.width, m_guideFormat ), guide_pitch, data.albedoOnDevice );
+    if( data.normal && slot.guideLayer.normal.data )
+        uploadSlotImage( slot, guides + 1, slot.guideLayer.normal, in.regionStart( data.normal, data.width, m_guideFormat ), guide_pitch, data.normalOnDevice );
+    if( data.flow && slot.guideLayer.flow.data )
+        uploadSlotImage( slot, guides + 2, slot.guideLayer.flow, in.regionStart( data.flow, data.width, flow_format ),
+                         in.rowStrideInBytes( data.width, flow_format ), false );
+    else if( slot.guideLayer.flow.data )
+        CUDA_CHECK( cudaMemsetAsync( reinterpret_cast<void*>( slot.guideLayer.flow.data ), 0,
+                                     size_t( slot.guideLayer.flow.rowStrideInBytes ) * slot.guideLayer.flow.height, m_uploadStream ) );
+    CUDA_CHECK( cudaEventRecord( slot.uploaded, m_uploadStream ) );
+
+    //
+    // denoise, ordered after the upload and after all earlier work on m_stream
+    //
+    for( size_t i=0; i < slot.layers.size(); i++ )
+    {
+        if( m_temporalMode )
+            slot.layers[i].previousOutput = previous ? previous->layers[i].output : slot.layers[i].input;
+    }
+    CUDA_CHECK( cudaStreamWaitEvent( m_stream, slot.uploaded, 0 ) );
+    computeExposure( slot.layers[0].input );
+    OPTIX_CHECK( optixUtilDenoiserInvokeTiled(
+                m_denoiser,
+                m_stream,
+                &m_params,
+                m_state,
+                m_state_size,
+                &slot.guideLayer,
+                slot.layers.data(),
+                static_cast<unsigned int>( slot.layers.size() ),
+                m_scratch,
+                m_scratch_size,
+                m_overlap,
+                m_tileWidth,
+                m_tileHeight
+                ) );
+    CUDA_CHECK( cudaEventRecord( slot.denoised, m_stream ) );
+
+    //
+    // readback into the slot's page-locked outputs
+    //
+    CUDA_CHECK( cudaStreamWaitEvent( m_downloadStream, slot.denoised, 0 ) );
+    for( size_t i=0; i < slot.layers.size(); i++ )
+        downloadOptixImage2D( slot.hostOutputs[i], slot.layers[i].output, m_downloadStream );
+    CUDA_CHECK( cudaEventRecord( slot.readBack, m_downloadStream ) );
+
+    return slot.id;
+}
+
+bool OptiXDenoiser::pollFrame( uint64_t frame )
+{
+    selectDevice();
+    // 0 is what a failed submitFrame returns, and the id of slots never submitted
+    if( frame == 0 || frame > m_lastFrame )
+        return false;
+    for( size_t s=0; s < m_slots.size(); s++ )
+    {
+        if( m_slots[s].id != frame || !m_slots[s].readBack )
+            continue;
+        const cudaError_t status = cudaEventQuery( m_slots[s].readBack );
+        if( status == cudaErrorNotReady )
+            return false;
+        CUDA_CHECK( status );
+        return true;
+    }
+    return true;    // slot already reused, so the frame has long completed
+}
+
+const float* OptiXDenoiser::frameResult( uint64_t frame, size_t layer )
+{
+    selectDevice();
+    if( frame == 0 )
+        return nullptr;
+    for( size_t s=0; s < m_slots.size(); s++ )
+    {
+        FrameSlot& slot = m_slots[s];
+        if( slot.id != frame || !slot.readBack || layer >= slot.hostOutputs.size() )
+            continue;
+        CUDA_CHECK( cudaEventSynchronize( slot.readBack ) );
+        return slot.hostOutputs[layer];
+    }
+    return nullptr;
+}
+
+void OptiXDenoiser::resizeImages( unsigned int width, unsigned int height )
+{
+    OptixImage2D* images[] = { &m_guideLayer.albedo, &m_guideLayer.normal, &m_guideLayer.flow };
+    for( OptixImage2D* oi : images )
+    {
+        oi->width  = width;
+        oi->height = height;
+    }
+    for( size_t i=0; i < m_layers.size(); i++ )
+    {
+        m_layers[i].input.width           = width;
+        m_layers[i].input.height          = height;
+        m_layers[i].output.width          = width;
+        m_layers[i].output.height         = height;
+        m_layers[i].previousOutput.width  = width;
+        m_layers[i].previousOutput.height = height;
+    }
+    for( size_t i=0; i < m_history.size(); i++ )
+    {
+        m_history[i].width  = width;
+        m_history[i].height = height;
+    }
+}
+
+void OptiXDenoiser::releaseImages()
+{
+    if( !m_albedoOnDevice )
+        deviceFree( m_guideLayer.albedo.data );
+    if( !m_normalOnDevice )
+        deviceFree( m_guideLayer.normal.data );
+    deviceFree( m_guideLayer.flow.data );
+    for( size_t i = m_colorOnDevice ? 1 : 0; i < m_layers.size(); i++ )
+        deviceFree( m_layers[i].input.data );
+    for( size_t i = m_outputOnDevice ? 1 : 0; i < m_layers.size(); i++ )
+        deviceFree( m_layers[i].output.data ); 
+    for( size_t i=0; i < m_history.size(); i++ )
+        deviceFree( m_history[i].data );
+    m_history.clear();
+
+    m_guideLayer = {};
+    m_layers.clear();
+}
+
+bool OptiXDenoiser::workingMemoryAllocated( const Data& data ) const
+{
+    if( !m_scratch || !m_state || !( m_intensity || m_avgColor ) || m_layers.empty() )
+        return false;
+    if( ( data.albedo && !m_guideLayer.albedo.data ) || ( data.normal && !m_guideLayer.normal.data ) )
+        return false;
+    for( size_t i=0; i < m_layers.size(); i++ )
+    {
+        if( !m_layers[i].input.data || !m_layers[i].output.data )
+            return false;
+    }
+    for( size_t i=0; i < m_history.size(); i++ )
+    {
+        if( !m_history[i].data )
+            return false;
+    }
+    return !m_temporalMode || m_guideLayer.flow.data;
+}
+
+void OptiXDenoiser::releaseWorkingMemory()
+{
+    deviceFree( m_intensity );
+    deviceFree( m_avgColor );
+    deviceFree( m_scratch );
+    deviceFree( m_state );
+    releaseSlots();
+    releaseImages();
+
+    m_setupKey         = SetupKey();
+    m_intensity        = 0;
+    m_avgColor         = 0;
+    m_scratch          = 0;
+    m_scratch_capacity = 0;
+    m_state            = 0;
+    m_state_capacity   = 0;
+    m_tileWidth        = 0;
+    m_tileHeight       = 0;
+    m_allocWidth       = 0;
+    m_allocHeight      = 0;
+}
+
+void OptiXDenoiser::finish() 
+{
+    selectDevice();
+    if( m_stream )
+        CUDA_CHECK( cudaStreamSynchronize( m_stream ) );
+    wait( m_lastTicket );
+    releaseSlots();
+    m_exposureFixed = false;
+    for( size_t i=0; i < m_freeEvents.size(); i++ )
+        CUDA_CHECK( cudaEventDestroy( m_freeEvents[i] ) );
+    m_freeEvents.clear();
+
+    // Cleanup resources
+    releaseDenoiserCache();
+    optixDenoiserDestroy( m_denoiser );
+    optixDeviceContextDestroy( m_context );
+
+    releaseWorkingMemory();
+    m_staging.release();
+    std::vector< float4 >().swap( m_warpBuffer );
+    std::vector< unsigned char >().swap( m_warpRaw );
+    cudaStream_t* streams[] = { &m_stream, &m_uploadStream, &m_downloadStream };
+    for( cudaStream_t* stream : streams )
+    {
+        if( *stream )
+            CUDA_CHECK( cudaStreamDestroy( *stream ) );
+        *stream = nullptr;
+    }
+
+    m_denoiser         = nullptr;
+    m_denoiserModel.reset();
+    m_modelBytes       = 0;
+    m_context          = nullptr;
+}
+
+bool isOptiXDenoiserAvailable()
+{
+    return optiXDeviceCount() > 0;
+}
+
+unsigned int optiXDeviceCount()
+{
+    int device_count = 0;
+    if( cudaGetDeviceCount( &device_count ) != cudaSuccess || device_count == 0 )
+        return 0;
+    return initOptiX() == OPTIX_SUCCESS ? device_count : 0;
+}
+
+void* allocPinnedHostMemory( size_t bytes )
+{
+    void* ptr = nullptr;
+    CUDA_CHECK( cudaHostAlloc( &ptr, bytes, cudaHostAllocPortable ) );
+    return ptr;
+}
+
+void freePinnedHostMemory( void* ptr )
+{
+    CUDA_CHECK( cudaFreeHost( ptr ) );
+}
+
+std::unique_ptr<DenoiserBackend> createOptiXDenoiser( int device )
+{
+    return std::unique_ptr<DenoiserBackend>( new OptiXDenoiser( device ) );
+}
@@ -1,12 +1,19 @@
 #include "optix_denoiser_wrapper.h"
-
-#define NOMINMAX
-#include <cuda_runtime.h>
-#include <optix.h>
-#include <optix_function_table_definition.h>
-#include <optix_stubs.h>
-
-#include <optix_denoiser_tiling.h>
+#include "denoiser_backend.h"
+#include "denoiser_device_pool.h"
+#include "denoiser_model.h"
+#include "debug.h"
+#include "mpsc_queue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
 
 #define NOMINMAX
 #define TINYEXR_IMPLEMENTATION
@@ -33,713 +40,1111 @@ float* LoadRGBAFloatFromEXR(const char* texPath)
     return imageData;
 }
 
-//Color Enum
-enum class Color { Red, Green, Blue, Black, White, Yellow, Orange };
-
-class  Debug
+void RegisterDebugCallback(FuncCallBack cb) 
 {
-public:
-    static void Log(const char* message, Color color = Color::Black);
-    static void Log(const std::string message, Color color = Color::Black);
-    static void Log(const int message, Color color = Color::Black);
-    static void Log(const char message, Color color = Color::Black);
-    static void Log(const float message, Color color = Color::Black);
-    static void Log(const double message, Color color = Color::Black);
-    static void Log(const bool message, Color color = Color::Black);
-    static void send_log(const std::stringstream& ss, const Color& color);
-};
-
-//-------------------------------------------------------------------
-void  Debug::Log(const char* message, Color color) 
+    Debug::SetCallback(cb);
+}
+void optix_denoiser_set_log_level(int level)
 {
-    if (callbackInstance != nullptr)
-        callbackInstance(message, (int)color, (int)strlen(message));
+    Debug::SetLevel(static_cast<LogLevel>(std::min(std::max(level, OPTIX_DENOISER_LOG_DEBUG), OPTIX_DENOISER_LOG_NONE)));
 }
-
-void  Debug::Log(const std::string message, Color color) {
-    const char* tmsg = message.c_str();
-    if (callbackInstance != nullptr)
-        callbackInstance(tmsg, (int)color, (int)strlen(tmsg));
+void optix_denoiser_flush_log()
+{
+    Debug::Flush();
 }
 
-void  Debug::Log(const int message, Color color) {
-    std::stringstream ss;
-    ss << message;
-    send_log(ss, color);
+std::unique_ptr<DenoiserBackend> createDenoiserBackend(DenoiserBackendKind kind)
+{
+    switch (kind)
+    {
+    case DenoiserBackendKind::OptiX:
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+        if (isOptiXDenoiserAvailable())
+            return createOptiXDenoiser();
+#endif
+        LOG_ERROR("OptiX backend is not available");
+        return nullptr;
+    case DenoiserBackendKind::CPU:
+        return createCPUDenoiser();
+    case DenoiserBackendKind::Auto:
+    default:
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+        if (isOptiXDenoiserAvailable())
+            return createOptiXDenoiser();
+#endif
+        LOG_WARNING("No OptiX device found, falling back to the CPU backend");
+        return createCPUDenoiser();
+    }
 }
 
-void  Debug::Log(const char message, Color color) 
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+// decided once, so that every pointer is released the way it was allocated
+static bool use_pinned_host_memory()
 {
-    std::stringstream ss;
-    ss << message;
-    send_log(ss, color);
+    static const bool s_pinned = isOptiXDenoiserAvailable();
+    return s_pinned;
 }
+#endif
 
-void  Debug::Log(const float message, Color color) 
+void* allocHostMemory(size_t bytes)
 {
-    std::stringstream ss;
-    ss << message;
-    send_log(ss, color);
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+    if (use_pinned_host_memory())
+        return allocPinnedHostMemory(bytes);
+#endif
+    return malloc(bytes);
 }
 
-void  Debug::Log(const double message, Color color) 
+void freeHostMemory(void* ptr)
 {
-    std::stringstream ss;
-    ss << message;
-    send_log(ss, color);
+    if (ptr == nullptr)
+        return;
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+    if (use_pinned_host_memory())
+    {
+        freePinnedHostMemory(ptr);
+        return;
+    }
+#endif
+    free(ptr);
 }
 
-void Debug::Log(const bool message, Color color) 
+// One image submitted with optix_denoiser_ctx_submit_job. Referenced by the submitter's
+// handle and by the worker until it has signalled completion.
+struct OptixDenoiserWrapperJob : MpscNode
 {
-    std::stringstream ss;
-    if (message)
-        ss << "true";
-    else
-        ss << "false";
+    optix_denoiser_image_desc        image;
+    optix_denoiser_job_callback      callback  = nullptr;
+    void*                            user_data = nullptr;
+    std::promise<bool>               promise;
+    std::shared_future<bool>         done;
+    std::atomic<int>                 references{ 2 };
+};
+
+// State behind one optix_denoiser_handle. Calls on different handles are independent;
+// calls on the same handle from several threads are serialized by its mutex.
+struct OptixDenoiserWrapperContext
+{
+    std::mutex                       mutex;
+    DenoiserBackend::Data            data;
+    std::unique_ptr<DenoiserBackend> denoiser;
+    DenoiserBackendKind              backend_kind = DenoiserBackendKind::Auto;
+    bool                             persistent   = false;
+    bool                             host_staging = false;
+    unsigned int                     pipeline_depth = 2;
+    size_t                           memory_budget  = 0;           // device bytes, 0 = unlimited
+    bool                             temporal       = false;
+    bool                             kernel_prediction = false;
+    std::shared_ptr<const DenoiserModel> user_model;               // nullptr = built-in models
+    float*                           output_buffer   = nullptr;    // allocHostMemory
+    float*                           output_device   = nullptr;    // caller owned device output, if set
+    DenoiserImageLayout              output_layout;                // of output_device
+    size_t                           output_capacity = 0;          // in floats
+    std::vector<float*>              aov_outputs;                  // allocHostMemory, one per AOV
+    size_t                           aov_capacity    = 0;          // in floats, per AOV output
+
+    // background jobs: submitters push without locking, the worker sleeps on worker_wake
+    // only while the queue is empty
+    MpscQueue<OptixDenoiserWrapperJob> jobs;
+    std::once_flag                   worker_started;
+    std::thread                      worker;
+    std::atomic<bool>                worker_idle{ false };
+    std::atomic<bool>                worker_stop{ false };
+    std::mutex                       worker_mutex;
+    std::condition_variable          worker_wake;
+};
 
-    send_log(ss, color);
+typedef std::lock_guard<std::mutex> ContextLock;
+
+static void release_backend(OptixDenoiserWrapperContext* ctx)
+{
+    if (ctx->denoiser)
+        ctx->denoiser->finish();
+    ctx->denoiser.reset();
+    freeHostMemory(ctx->output_buffer);
+    ctx->output_buffer = nullptr;
+    ctx->output_capacity = 0;
+    for (float* aov : ctx->aov_outputs)
+        freeHostMemory(aov);
+    ctx->aov_outputs.clear();
+    ctx->aov_capacity = 0;
 }
 
-void Debug::send_log(const std::stringstream& ss, const Color& color) 
+// make room for a width*height float4 result, keeping the allocation while it fits
+static void reserve_output(OptixDenoiserWrapperContext* ctx)
 {
-    const std::string tmp = ss.str();
-    const char* tmsg = tmp.c_str();
-    std::cout << ss.str() << std::endl;
-    if (callbackInstance != nullptr)
-        callbackInstance(tmsg, (int)color, (int)strlen(tmsg));
+    const size_t needed = size_t(ctx->data.width) * ctx->data.height * 4;
+    if (needed <= ctx->output_capacity)
+        return;
+    freeHostMemory(ctx->output_buffer);
+    ctx->output_capacity = size_t(bucketImageDimension(ctx->data.width)) * bucketImageDimension(ctx->data.height) * 4;
+    ctx->output_buffer = static_cast<float*>(allocHostMemory(ctx->output_capacity * sizeof(float)));
 }
 
-void RegisterDebugCallback(FuncCallBack cb) 
+// make room for one result per AOV; they share the output layout, so with a device output
+// each is sized to hold the layout's region
+static void reserve_aov_outputs(OptixDenoiserWrapperContext* ctx)
 {
-    callbackInstance = cb;
-}
-
-#define CUDA_CHECK( call )                                                     \
-    do                                                                         \
-    {                                                                          \
-        cudaError_t error = call;                                              \
-        if( error != cudaSuccess )                                             \
-        {                                                                      \
-            std::stringstream ss;                                              \
-            ss << "CUDA call (" << #call << " ) failed with error: '"          \
-               << cudaGetErrorString( error )                                  \
-               << "' (" __FILE__ << ":" << __LINE__ << ")";                    \
-            Debug::send_log(ss, Color::Red);                                   \
-        }                                                                      \
-    } while( 0 )
-
-#define SUTIL_ASSERT( cond )                                                   \
-    do                                                                         \
-    {                                                                          \
-        if( !(cond) )                                                          \
-        {                                                                      \
-            std::stringstream ss;                                              \
-            ss << ": " << __FILE__ << " (" << __LINE__ << "): " << #cond;      \
-            Debug::send_log(ss, Color::Red);                                   \
-            std::cout << __FILE__ << " (" << __LINE__ << "): " << #cond;       \
-        }                                                                      \
-    } while( 0 )
-
-#define SUTIL_ASSERT_MSG( cond, msg )                                          \
-    do                                                                         \
-    {                                                                          \
-        if( !(cond) )                                                          \
-        {                                                                      \
-            std::stringstream ss;                                              \
-            ss << ": " << __FILE__ << " (" << __LINE__ << "): " << #cond;      \
-            Debug::send_log(ss, Color::Red);                                   \
-            std::cout << ": " << __FILE__ << " (" << __LINE__ << "): " << #cond ; \
-        }                                                                      \
-    } while( 0 )
-
-#define OPTIX_CHECK( call )                                                    \
-    do                                                                         \
-    {                                                                          \
-        OptixResult res = call;                                                \
-        if( res != OPTIX_SUCCESS )                                             \
-        {                                                                      \
-            std::stringstream ss;                                              \
-            ss << "Optix call '" << #call << "' failed: " __FILE__ ":"         \
-               << __LINE__ << ")";                                             \
-            Debug::send_log(ss, Color::Red);                                   \
-        }                                                                      \
-    } while( 0 )
-
-#define CUDA_SYNC_CHECK()                                                      \
-    do                                                                         \
-    {                                                                          \
-        cudaDeviceSynchronize();                                               \
-        cudaError_t error = cudaGetLastError();                                \
-        if( error != cudaSuccess )                                             \
-        {                                                                      \
-            std::stringstream ss;                                              \
-            ss << "CUDA error on synchronize with error '"                     \
-               << cudaGetErrorString( error )                                  \
-               << "' (" __FILE__ << ":" << __LINE__ << ")";                    \
-            Debug::send_log(ss, Color::Red);                                   \
-        }                                                                      \
-    } while( 0 )
-
-
-static void context_log_cb( uint32_t level, const char* tag, const char* message, void* /*cbdata*/ )
-{
-    if( level < 4 )
-        std::cerr << "[" << std::setw( 2 ) << level << "][" << std::setw( 12 ) << tag << "]: "
-                  << message << "\n";
-}
-
-// create four channel float OptixImage2D with given dimension. allocate memory on device and
-// copy data from host memory given in hmem to device if hmem is nonzero.
-static OptixImage2D createOptixImage2D( unsigned int width, unsigned int height, const float * hmem = nullptr ) 
-{
-    OptixImage2D oi;
-
-    const uint64_t frame_byte_size = width * height * sizeof(float4);
-    CUDA_CHECK( cudaMalloc( reinterpret_cast<void**>( &oi.data ), frame_byte_size ) );
-    if( hmem )
+    const DenoiserImageLayout layout = ctx->output_device ? ctx->output_layout : DenoiserImageLayout();
+    const size_t row_floats = layout.rowStrideInBytes(bucketImageDimension(ctx->data.width), DenoiserPixelFormat::Float4) / sizeof(float);
+    const size_t needed = row_floats * (layout.originY + bucketImageDimension(ctx->data.height));
+    if (needed > ctx->aov_capacity)
     {
-        CUDA_CHECK( cudaMemcpy(
-                    reinterpret_cast<void*>( oi.data ),
-                    hmem,
-                    frame_byte_size,
-                    cudaMemcpyHostToDevice
-                    ) );
+        for (float* aov : ctx->aov_outputs)
+            freeHostMemory(aov);
+        ctx->aov_outputs.clear();
+        ctx->aov_capacity = needed;
     }
-    oi.width              = width;
-    oi.height             = height;
-    oi.rowStrideInBytes   = width*sizeof(float4);
-    oi.pixelStrideInBytes = sizeof(float4);
-    oi.format             = OPTIX_PIXEL_FORMAT_FLOAT4;
-    return oi;
+    while (ctx->aov_outputs.size() < ctx->data.aovs.size())
+        ctx->aov_outputs.push_back(static_cast<float*>(allocHostMemory(ctx->aov_capacity * sizeof(float))));
 }
 
-class OptiXDenoiser
+// point the backend at the caller's device output, or at the instance owned host buffer,
+// followed by the AOV outputs
+static void bind_output(OptixDenoiserWrapperContext* ctx)
 {
-public:
-    struct Data
-    {
-        uint32_t  width    = 0;
-        uint32_t  height   = 0;
-        float*    color    = nullptr;
-        float*    albedo   = nullptr;
-        float*    normal   = nullptr;
-        float*    flow     = nullptr;
-        std::vector< float* > aovs;     // input AOVs
-        std::vector< float* > outputs;  // denoised beauty, followed by denoised AOVs
-        
-        void clear()
-        {
-            width = 0;
-            height = 0;
-            color = nullptr;
-            albedo = nullptr;
-            normal = nullptr;
-            aovs.clear();
-            outputs.clear();
-        }
-    };
-
-    // Initialize the API and push all data to the GPU -- normaly done only once per session
-    // tileWidth, tileHeight: if nonzero, enable tiling with given dimension
-    // kpMode: if enabled, use kernel prediction model even if no AOVs are given
-    // temporalMode: if enabled, use a model for denoising sequences of images
-    void init( const Data&  data,
-               unsigned int tileWidth = 0,
-               unsigned int tileHeight = 0,
-               bool         kpMode = false,
-               bool         temporalMode = false );
-
-    // Execute the denoiser. In interactive sessions, this would be done once per frame/subframe
-    void exec();
-
-    // Update denoiser input data on GPU from host memory
-    void update( const Data& data );
-
-    // Copy results from GPU to host memory
-    void getResults();
-
-    // Cleanup state, deallocate memory -- normally done only once per render session
-    void finish(); 
-
-    // --- test flow vectors: flow is applied to noisy input image and written back to result
-    // --- no denoising.
-    void getFlowResults();
-
-private:
-    OptixDeviceContext    m_context      = nullptr;
-    OptixDenoiser         m_denoiser     = nullptr;
-    OptixDenoiserParams   m_params       = {};
-
-    bool                  m_temporalMode;
-
-    CUdeviceptr           m_intensity    = 0;
-    CUdeviceptr           m_avgColor     = 0;
-    CUdeviceptr           m_scratch      = 0;
-    uint32_t              m_scratch_size = 0;
-    CUdeviceptr           m_state        = 0;
-    uint32_t              m_state_size   = 0;
-
-    unsigned int          m_tileWidth    = 0;
-    unsigned int          m_tileHeight   = 0;
-    unsigned int          m_overlap      = 0;
-
-    OptixDenoiserGuideLayer           m_guideLayer = {};
-    std::vector< OptixDenoiserLayer > m_layers;
-    std::vector< float* >             m_host_outputs;
-};
+    ctx->data.outputs.assign(1, ctx->output_device ? ctx->output_device : ctx->output_buffer);
+    for (size_t i = 0; i < ctx->data.aovs.size() && i < ctx->aov_outputs.size(); i++)
+        ctx->data.outputs.push_back(ctx->aov_outputs[i]);
+    ctx->data.outputOnDevice = ctx->output_device != nullptr;
+    ctx->data.outputLayout = ctx->output_device ? ctx->output_layout : DenoiserImageLayout();
+}
 
-void OptiXDenoiser::init( const Data&  data,
-                          unsigned int tileWidth,
-                          unsigned int tileHeight,
-                          bool         kpMode,
-                          bool         temporalMode )
+static DenoiserImageLayout make_layout(uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y)
 {
-    SUTIL_ASSERT( data.color  );
-    SUTIL_ASSERT( data.outputs.size() >= 1 );
-    SUTIL_ASSERT( data.width  );
-    SUTIL_ASSERT( data.height );
-    SUTIL_ASSERT_MSG( !data.normal || data.albedo, "Currently albedo is required if normal input is given" );
-    SUTIL_ASSERT_MSG( ( tileWidth == 0 && tileHeight == 0 ) || ( tileWidth > 0 && tileHeight > 0 ), "tile size must be > 0 for width and height" );
-
-    m_host_outputs = data.outputs;
-    m_temporalMode = temporalMode;
-
-    m_tileWidth  = tileWidth > 0 ? tileWidth : data.width;
-    m_tileHeight = tileHeight > 0 ? tileHeight : data.height;
+    DenoiserImageLayout layout;
+    layout.rowPitch = row_pitch;
+    layout.originX = origin_x;
+    layout.originY = origin_y;
+    return layout;
+}
 
-    //
-    // Initialize CUDA and create OptiX context
-    //
+static DenoiserPixelFormat to_pixel_format(int format)
+{
+    switch (format)
     {
-        // Initialize CUDA
-        CUDA_CHECK( cudaFree( nullptr ) );
-
-        CUcontext cu_ctx = nullptr;  // zero means take the current context
-        OPTIX_CHECK( optixInit() );
-        OptixDeviceContextOptions options = {};
-        options.logCallbackFunction       = &context_log_cb;
-        options.logCallbackLevel          = 4;
-        OPTIX_CHECK( optixDeviceContextCreate( cu_ctx, &options, &m_context ) );
+    case OPTIX_DENOISER_FORMAT_FLOAT3: return DenoiserPixelFormat::Float3;
+    case OPTIX_DENOISER_FORMAT_HALF4:  return DenoiserPixelFormat::Half4;
+    case OPTIX_DENOISER_FORMAT_HALF3:  return DenoiserPixelFormat::Half3;
+    default:                           return DenoiserPixelFormat::Float4;
     }
+}
 
-    //
-    // Create denoiser
-    //
+static DenoiserBackendKind to_backend_kind(int backend)
+{
+    switch (backend)
     {
-        /*****
-        // load user provided model if model.bin is present in the currrent directory,
-        // configuration of filename not done here.
-        std::ifstream file( "model.bin" );
-        if ( file.good() ) {
-            std::stringstream source_buffer;
-            source_buffer << file.rdbuf();
-            OPTIX_CHECK( optixDenoiserCreateWithUserModel( m_context, (void*)source_buffer.str().c_str(), source_buffer.str().size(), &m_denoiser ) );
-        }
-        else
-        *****/
-        {
-            OptixDenoiserOptions options = {};
-            options.guideAlbedo = data.albedo ? 1 : 0;
-            options.guideNormal = data.normal ? 1 : 0;
-
-            OptixDenoiserModelKind modelKind;
-            if( kpMode || data.aovs.size() > 0 )
-            {
-                SUTIL_ASSERT( !temporalMode );
-                modelKind = OPTIX_DENOISER_MODEL_KIND_AOV;
-            }
-            else
-            {
-                modelKind = temporalMode ? OPTIX_DENOISER_MODEL_KIND_TEMPORAL : OPTIX_DENOISER_MODEL_KIND_HDR;
-            }
-            OPTIX_CHECK( optixDenoiserCreate( m_context, modelKind, &options, &m_denoiser ) );
-        }
+    case OPTIX_DENOISER_BACKEND_OPTIX: return DenoiserBackendKind::OptiX;
+    case OPTIX_DENOISER_BACKEND_CPU:   return DenoiserBackendKind::CPU;
+    default:                           return DenoiserBackendKind::Auto;
     }
+}
 
+static bool has_device_images(const DenoiserBackend::Data& data)
+{
+    return data.colorOnDevice || data.albedoOnDevice || data.normalOnDevice || data.outputOnDevice;
+}
 
-    //
-    // Allocate device memory for denoiser
-    //
+// Make ctx->denoiser a backend of the requested kind, keeping the current one if reuse is set
+// and it matches. Returns false if no backend is available.
+static bool acquire_backend(OptixDenoiserWrapperContext* ctx, bool reuse)
+{
+    if (!reuse || !ctx->denoiser
+        || (ctx->backend_kind != DenoiserBackendKind::Auto && ctx->backend_kind != ctx->denoiser->kind()))
     {
-        OptixDenoiserSizes denoiser_sizes;
-
-        OPTIX_CHECK( optixDenoiserComputeMemoryResources(
-                    m_denoiser,
-                    m_tileWidth,
-                    m_tileHeight,
-                    &denoiser_sizes
-                    ) );
-
-        if( tileWidth == 0 )
-        {
-            m_scratch_size = static_cast<uint32_t>( denoiser_sizes.withoutOverlapScratchSizeInBytes );
-            m_overlap = 0;
-        }
-        else
-        {
-            m_scratch_size = static_cast<uint32_t>( denoiser_sizes.withOverlapScratchSizeInBytes );
-            m_overlap = denoiser_sizes.overlapWindowSizeInPixels;
-        }
-
-        if( data.aovs.size() == 0 && kpMode == false )
-        {
-            CUDA_CHECK( cudaMalloc(
-                        reinterpret_cast<void**>( &m_intensity ),
-                        sizeof( float )
-                        ) );
-        }
-        else
-        {
-            CUDA_CHECK( cudaMalloc(
-                        reinterpret_cast<void**>( &m_avgColor ),
-                        3 * sizeof( float )
-                        ) );
-        }
-
-        CUDA_CHECK( cudaMalloc(
-                    reinterpret_cast<void**>( &m_scratch ),
-                    m_scratch_size 
-                    ) );
-
-        CUDA_CHECK( cudaMalloc(
-                    reinterpret_cast<void**>( &m_state ),
-                    denoiser_sizes.stateSizeInBytes
-                    ) );
-
-        m_state_size = static_cast<uint32_t>( denoiser_sizes.stateSizeInBytes );
-
-        OptixDenoiserLayer layer = {};
-        layer.input  = createOptixImage2D( data.width, data.height, data.color );
-        layer.output = createOptixImage2D( data.width, data.height );
-        if( m_temporalMode )
-        {
-            // this is the first frame, create zero motion vector image
-            void * flowmem;
-            CUDA_CHECK( cudaMalloc( &flowmem, data.width * data.height * sizeof( float4 ) ) );
-            CUDA_CHECK( cudaMemset( flowmem, 0, data.width * data.height * sizeof(float4) ) );
-            m_guideLayer.flow = {(CUdeviceptr)flowmem, data.width, data.height, (unsigned int)(data.width * sizeof( float4 )), (unsigned int)sizeof( float4 ), OPTIX_PIXEL_FORMAT_FLOAT4 };
-
-            layer.previousOutput = layer.input;         // first frame
-        }
-        m_layers.push_back( layer );
+        if (ctx->denoiser)
+            ctx->denoiser->finish();
+        ctx->denoiser = createDenoiserBackend(ctx->backend_kind);
+        if (!ctx->denoiser)
+            return false;
+        LOG_INFO("Denoiser Backend:%s", ctx->denoiser->name());
+    }
+    ctx->denoiser->setHostStaging(ctx->host_staging);
+    ctx->denoiser->setPipelineDepth(ctx->pipeline_depth);
+    ctx->denoiser->setMemoryBudget(ctx->memory_budget);
+    ctx->denoiser->setUserModel(ctx->user_model);
+    if (ctx->user_model && ctx->denoiser->kind() == DenoiserBackendKind::CPU)
+        LOG_WARNING("User models require the OptiX backend");
+    return true;
+}
 
-        if( data.albedo )
-            m_guideLayer.albedo = createOptixImage2D( data.width, data.height, data.albedo );
-        if( data.normal )
-            m_guideLayer.normal = createOptixImage2D( data.width, data.height, data.normal );
+optix_denoiser_handle optix_denoiser_create()
+{
+    return new OptixDenoiserWrapperContext();
+}
+static void stop_worker(OptixDenoiserWrapperContext* ctx);
 
-        for( size_t i=0; i < data.aovs.size(); i++ )
+void optix_denoiser_destroy(optix_denoiser_handle ctx)
+{
+    if (ctx == nullptr)
+        return;
+    stop_worker(ctx);
+    release_backend(ctx);
+    delete ctx;
+}
+void optix_denoiser_ctx_set_backend(optix_denoiser_handle ctx, int backend)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->backend_kind = to_backend_kind(backend);
+}
+int optix_denoiser_ctx_get_backend(optix_denoiser_handle ctx)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return OPTIX_DENOISER_BACKEND_AUTO;
+    return ctx->denoiser->kind() == DenoiserBackendKind::CPU ? OPTIX_DENOISER_BACKEND_CPU : OPTIX_DENOISER_BACKEND_OPTIX;
+}
+void optix_denoiser_ctx_set_persistent(optix_denoiser_handle ctx, int enabled)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->persistent = enabled != 0;
+}
+void optix_denoiser_ctx_set_host_staging(optix_denoiser_handle ctx, int enabled)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->host_staging = enabled != 0;
+    if (ctx->denoiser)
+        ctx->denoiser->setHostStaging(ctx->host_staging);
+}
+void optix_denoiser_ctx_set_memory_budget(optix_denoiser_handle ctx, uint64_t bytes)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->memory_budget = size_t(bytes);
+}
+void optix_denoiser_ctx_set_temporal(optix_denoiser_handle ctx, int enabled)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->temporal = enabled != 0;
+}
+int optix_denoiser_ctx_set_model_file(optix_denoiser_handle ctx, const char* path)
+{
+    // load outside the lock, the first load of a file reads all of it
+    std::shared_ptr<const DenoiserModel> model;
+    if (path && *path)
+    {
+        model = loadDenoiserModel(path);
+        if (!model)
+            return 0;
+    }
+    ContextLock lock(ctx->mutex);
+    ctx->user_model = model;
+    return 1;
+}
+void optix_denoiser_ctx_set_image_size(optix_denoiser_handle ctx, uint32_t width, uint32_t height)
+{
+    LOG_DEBUG("Width:%u", width);
+    LOG_DEBUG("Height:%u", height);
+    ContextLock lock(ctx->mutex);
+    ctx->data.width = width;
+    ctx->data.height = height;
+}
+void optix_denoiser_ctx_set_input_format(optix_denoiser_handle ctx, int format)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.inputFormat = to_pixel_format(format);
+}
+void optix_denoiser_ctx_set_guide_format(optix_denoiser_handle ctx, int format)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.guideFormat = to_pixel_format(format);
+}
+void optix_denoiser_ctx_set_output_format(optix_denoiser_handle ctx, int format)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.outputFormat = to_pixel_format(format);
+}
+void optix_denoiser_ctx_set_input_layout(optix_denoiser_handle ctx, uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.inputLayout = make_layout(row_pitch, origin_x, origin_y);
+}
+void optix_denoiser_ctx_set_output_layout(optix_denoiser_handle ctx, uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->output_layout = make_layout(row_pitch, origin_x, origin_y);
+}
+void optix_denoiser_ctx_set_source_data_pointer(optix_denoiser_handle ctx, float* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.color = ptr;
+    ctx->data.colorOnDevice = false;
+}
+void optix_denoiser_ctx_set_normal_data_pointer(optix_denoiser_handle ctx, float* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.normal = ptr;
+    ctx->data.normalOnDevice = false;
+}
+void optix_denoiser_ctx_set_albedo_data_pointer(optix_denoiser_handle ctx, float* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.albedo = ptr;
+    ctx->data.albedoOnDevice = false;
+}
+void optix_denoiser_ctx_set_flow_data_pointer(optix_denoiser_handle ctx, float* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.flow = ptr;
+}
+void optix_denoiser_ctx_set_aov_count(optix_denoiser_handle ctx, uint32_t count)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.aovs.resize(count, nullptr);
+}
+void optix_denoiser_ctx_set_aov_data_pointer(optix_denoiser_handle ctx, uint32_t index, float* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    if (index >= ctx->data.aovs.size())
+    {
+        LOG_ERROR("AOV index out of range:%u", index);
+        return;
+    }
+    ctx->data.aovs[index] = ptr;
+}
+void optix_denoiser_ctx_set_kernel_prediction(optix_denoiser_handle ctx, int enabled)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->kernel_prediction = enabled != 0;
+}
+void optix_denoiser_ctx_set_source_device_pointer(optix_denoiser_handle ctx, void* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.color = static_cast<float*>(ptr);
+    ctx->data.colorOnDevice = ptr != nullptr;
+}
+void optix_denoiser_ctx_set_normal_device_pointer(optix_denoiser_handle ctx, void* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.normal = static_cast<float*>(ptr);
+    ctx->data.normalOnDevice = ptr != nullptr;
+}
+void optix_denoiser_ctx_set_albedo_device_pointer(optix_denoiser_handle ctx, void* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->data.albedo = static_cast<float*>(ptr);
+    ctx->data.albedoOnDevice = ptr != nullptr;
+}
+void optix_denoiser_ctx_set_output_device_pointer(optix_denoiser_handle ctx, void* ptr)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->output_device = static_cast<float*>(ptr);
+}
+int optix_denoiser_ctx_query_memory_requirements(optix_denoiser_handle ctx, uint32_t width, uint32_t height, int guides, uint32_t aovs, uint32_t tile_width, uint32_t tile_height, optix_denoiser_memory_requirements* requirements)
+{
+    ContextLock lock(ctx->mutex);
+    if (!requirements || !acquire_backend(ctx, true))
+        return 0;
+
+    DenoiserConfig config(ctx->data, tile_width, tile_height);
+    config.width = width;
+    config.height = height;
+    config.albedo = (guides & OPTIX_DENOISER_GUIDE_ALBEDO) != 0;
+    config.normal = (guides & OPTIX_DENOISER_GUIDE_NORMAL) != 0;
+    config.aovs = aovs;
+    config.outputOnDevice = ctx->output_device != nullptr;
+    config.temporalMode = ctx->temporal;
+    config.kpMode = ctx->kernel_prediction;
+    const DenoiserMemoryRequirements needed = ctx->denoiser->queryMemoryRequirements(config);
+
+    requirements->inputs = needed.inputs;
+    requirements->outputs = needed.outputs;
+    requirements->guides = needed.guides;
+    requirements->flow = needed.flow;
+    requirements->scratch = needed.scratch;
+    requirements->state = needed.state;
+    requirements->model = needed.model;
+    requirements->device_total = needed.deviceTotal();
+    requirements->host_total = needed.hostTotal();
+    // see reserve_output
+    if (!ctx->output_device)
+        requirements->host_total += uint64_t(bucketImageDimension(width)) * bucketImageDimension(height) * 4 * sizeof(float);
+    // see reserve_aov_outputs, assuming the default output layout
+    requirements->host_total += uint64_t(aovs) * bucketImageDimension(width) * bucketImageDimension(height) * 4 * sizeof(float);
+    requirements->tile_width = needed.tileWidth;
+    requirements->tile_height = needed.tileHeight;
+    requirements->overlap = needed.overlap;
+    return 1;
+}
+void optix_denoiser_ctx_init(optix_denoiser_handle ctx)
+{
+    LOG_DEBUG("Denoiser Init");
+    ContextLock lock(ctx->mutex);
+    for (float* aov : ctx->data.aovs)
+    {
+        if (!aov)
         {
-            layer.input  = createOptixImage2D( data.width, data.height, data.aovs[i] );
-            layer.output = createOptixImage2D( data.width, data.height );
-            if( m_temporalMode )
-                layer.previousOutput = layer.input;     // first frame
-            m_layers.push_back( layer );
+            LOG_ERROR("Every AOV needs a data pointer");
+            return;
         }
     }
-
-    //
-    // Setup denoiser
-    //
+    if (ctx->temporal && (ctx->kernel_prediction || !ctx->data.aovs.empty()))
     {
-        OPTIX_CHECK( optixDenoiserSetup(
-                    m_denoiser,
-                    nullptr,  // CUDA stream
-                    m_tileWidth + 2 * m_overlap,
-                    m_tileHeight + 2 * m_overlap,
-                    m_state,
-                    m_state_size,
-                    m_scratch,
-                    m_scratch_size
-                    ) );
-
-
-        m_params.denoiseAlpha    = 0;
-        m_params.hdrIntensity    = m_intensity;
-        m_params.hdrAverageColor = m_avgColor;
-        m_params.blendFactor     = 0.0f;
+        LOG_ERROR("Temporal mode does not support AOVs or kernel prediction");
+        return;
     }
+    reserve_output(ctx);
+    reserve_aov_outputs(ctx);
+    bind_output(ctx);
+    // persistent sessions keep device context and denoiser, the backend only rebuilds what changed
+    if (!acquire_backend(ctx, ctx->persistent))
+        return;
+    if (ctx->denoiser->kind() == DenoiserBackendKind::CPU && has_device_images(ctx->data))
+    {
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+        // the host filter cannot read device memory
+        LOG_ERROR("Device pointers require the OptiX backend");
+        ctx->denoiser->finish();
+        ctx->denoiser.reset();
+        return;
+#endif
+    }
+    if (!ctx->denoiser->init(ctx->data, 0, 0, ctx->kernel_prediction, ctx->temporal))
+    {
+        // update and exec are no-ops until the next successful init
+        ctx->denoiser->finish();
+        ctx->denoiser.reset();
+    }
+}
+void optix_denoiser_ctx_update(optix_denoiser_handle ctx)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return;
+    bind_output(ctx);
+    ctx->denoiser->update(ctx->data);
+}
+void optix_denoiser_ctx_exec(optix_denoiser_handle ctx)
+{
+    LOG_DEBUG("Denoiser Exec");
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return;
+    ctx->denoiser->exec();
+}
+uint64_t optix_denoiser_ctx_exec_async(optix_denoiser_handle ctx)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return 0;
+    return ctx->denoiser->execAsync();
+}
+int optix_denoiser_ctx_poll(optix_denoiser_handle ctx, uint64_t ticket)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return 1;
+    return ctx->denoiser->poll(ticket) ? 1 : 0;
+}
+void optix_denoiser_ctx_wait(optix_denoiser_handle ctx, uint64_t ticket)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return;
+    ctx->denoiser->wait(ticket);
+}
+float* optix_denoiser_ctx_get_result(optix_denoiser_handle ctx)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return nullptr;
+    ctx->denoiser->getResults();
+    return ctx->data.outputs[0];
+}
+float* optix_denoiser_ctx_get_aov_result(optix_denoiser_handle ctx, uint32_t index)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser || size_t(index) + 1 >= ctx->data.outputs.size())
+        return nullptr;
+    return ctx->data.outputs[index + 1];
+}
+float* optix_denoiser_ctx_exec_region(optix_denoiser_handle ctx, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return nullptr;
+    if (ctx->temporal)
+    {
+        LOG_ERROR("Region denoising is not available in temporal mode");
+        return nullptr;
+    }
+    bind_output(ctx);
+    ctx->denoiser->execRegion(ctx->data, x, y, width, height);
+    return ctx->data.outputs[0];
+}
+void optix_denoiser_ctx_set_pipeline_depth(optix_denoiser_handle ctx, uint32_t depth)
+{
+    ContextLock lock(ctx->mutex);
+    ctx->pipeline_depth = depth;
+    if (ctx->denoiser)
+        ctx->denoiser->setPipelineDepth(depth);
+}
+uint64_t optix_denoiser_ctx_submit_frame(optix_denoiser_handle ctx)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return 0;
+    return ctx->denoiser->submitFrame(ctx->data);
+}
+int optix_denoiser_ctx_poll_frame(optix_denoiser_handle ctx, uint64_t frame)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return 1;
+    return ctx->denoiser->pollFrame(frame) ? 1 : 0;
+}
+const float* optix_denoiser_ctx_get_frame_result(optix_denoiser_handle ctx, uint64_t frame)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->denoiser)
+        return nullptr;
+    return ctx->denoiser->frameResult(frame, 0);
+}
+static void to_stage_timing(const StageStatistics& statistics, optix_denoiser_stage_timing* timing)
+{
+    timing->last_ms = statistics.last;
+    timing->mean_ms = statistics.mean;
+    timing->min_ms = statistics.min;
+    timing->max_ms = statistics.max;
+    timing->samples = statistics.samples;
+}
+int optix_denoiser_ctx_get_stage_timings(optix_denoiser_handle ctx, optix_denoiser_stage_timings* timings)
+{
+    ContextLock lock(ctx->mutex);
+    if (!timings || !ctx->denoiser)
+        return 0;
+    to_stage_timing(ctx->denoiser->stageStatistics(DenoiserStage::Upload), &timings->upload);
+    to_stage_timing(ctx->denoiser->stageStatistics(DenoiserStage::Intensity), &timings->intensity);
+    to_stage_timing(ctx->denoiser->stageStatistics(DenoiserStage::Invoke), &timings->invoke);
+    to_stage_timing(ctx->denoiser->stageStatistics(DenoiserStage::Wait), &timings->wait);
+    to_stage_timing(ctx->denoiser->stageStatistics(DenoiserStage::Download), &timings->download);
+    return 1;
+}
+void optix_denoiser_ctx_reset_stage_timings(optix_denoiser_handle ctx)
+{
+    ContextLock lock(ctx->mutex);
+    if (ctx->denoiser)
+        ctx->denoiser->resetStageTimings();
+}
+void optix_denoiser_ctx_free(optix_denoiser_handle ctx)
+{
+    ContextLock lock(ctx->mutex);
+    if (!ctx->persistent)
+        release_backend(ctx);
+    ctx->data.clear();
+    ctx->output_device = nullptr;
+    ctx->output_layout = DenoiserImageLayout();
 }
 
-void OptiXDenoiser::update( const Data& data )
+static DenoiserBackend::Data batch_data(const OptixDenoiserWrapperContext* ctx, const optix_denoiser_image_desc& image)
 {
-    SUTIL_ASSERT( data.color  );
-    SUTIL_ASSERT( data.outputs.size() >= 1 );
-    SUTIL_ASSERT( data.width  );
-    SUTIL_ASSERT( data.height );
-    SUTIL_ASSERT_MSG( !data.normal || data.albedo, "Currently albedo is required if normal input is given" );
+    DenoiserBackend::Data data;
+    data.width = image.width;
+    data.height = image.height;
+    data.color = image.color;
+    data.albedo = image.albedo;
+    data.normal = image.normal;
+    data.outputs.assign(1, image.output);
+    data.inputFormat = ctx->data.inputFormat;
+    data.guideFormat = ctx->data.guideFormat;
+    data.outputFormat = ctx->data.outputFormat;
+    return data;
+}
 
-    m_host_outputs = data.outputs;
+static bool is_complete_image(const optix_denoiser_image_desc& image)
+{
+    return image.color && image.output && image.width && image.height && (!image.normal || image.albedo);
+}
 
-    CUDA_CHECK( cudaMemcpy( (void*)m_layers[0].input.data, data.color, data.width * data.height * sizeof( float4 ), cudaMemcpyHostToDevice ) );
+// guide set first, so that sorting by key only recreates the denoiser when the guides change
+typedef std::tuple<bool, bool, uint32_t, uint32_t> ImageKey;
 
-    if( m_temporalMode )
+static ImageKey image_key(const optix_denoiser_image_desc& image)
+{
+    return ImageKey(image.albedo != nullptr, image.normal != nullptr, image.width, image.height);
+}
+
+// Batch order: by guide set, then largest images first. The buffers and pipeline slots a group
+// allocates then usually fit the smaller groups after it, which init only resizes them for.
+struct BatchOrder
+{
+    bool operator()(const ImageKey& a, const ImageKey& b) const
     {
-        CUDA_CHECK( cudaMemcpy( (void*)m_guideLayer.flow.data, data.flow, data.width * data.height * sizeof( float4 ), cudaMemcpyHostToDevice ) );
-        m_layers[0].previousOutput = m_layers[0].output;
+        if (std::get<0>(a) != std::get<0>(b) || std::get<1>(a) != std::get<1>(b))
+            return std::make_pair(std::get<0>(a), std::get<1>(a)) < std::make_pair(std::get<0>(b), std::get<1>(b));
+        const uint64_t pixels_a = uint64_t(std::get<2>(a)) * std::get<3>(a);
+        const uint64_t pixels_b = uint64_t(std::get<2>(b)) * std::get<3>(b);
+        if (pixels_a != pixels_b)
+            return pixels_a > pixels_b;
+        return std::make_pair(std::get<2>(a), std::get<3>(a)) > std::make_pair(std::get<2>(b), std::get<3>(b));
     }
+};
 
-    if( data.albedo )
-        CUDA_CHECK( cudaMemcpy( (void*)m_guideLayer.albedo.data, data.albedo, data.width * data.height * sizeof( float4 ), cudaMemcpyHostToDevice ) );
-
-    if( data.normal )
-        CUDA_CHECK( cudaMemcpy( (void*)m_guideLayer.normal.data, data.normal, data.width * data.height * sizeof( float4 ), cudaMemcpyHostToDevice ) );
+// Results are read while later images are uploaded and denoised; a frame stays readable until
+// its slot is reused, i.e. for depth - 1 further submissions.
+static size_t result_lag(const OptixDenoiserWrapperContext* ctx)
+{
+    return std::min(std::max(ctx->pipeline_depth, 1u), 3u) - 1;
+}
 
-    for( size_t i=0; i < data.aovs.size(); i++ )
-    {
-        CUDA_CHECK( cudaMemcpy( (void*)m_layers[i].input.data, data.aovs[i], data.width * data.height * sizeof( float4 ), cudaMemcpyHostToDevice ) );
-        if( m_temporalMode )
-            m_layers[i].previousOutput = m_layers[i].output;
-    }
+// wait for a submitted frame and copy its result to image.output
+static bool read_frame_result(OptixDenoiserWrapperContext* ctx, uint64_t frame, const optix_denoiser_image_desc& image)
+{
+    const float* result = ctx->denoiser->frameResult(frame, 0);
+    if (!result)
+        return false;
+    memcpy(image.output, result, size_t(image.width) * image.height * pixelSizeInBytes(ctx->data.outputFormat));
+    return true;
 }
 
-void OptiXDenoiser::exec()
+int optix_denoiser_ctx_denoise_batch(optix_denoiser_handle ctx, const optix_denoiser_image_desc* images, uint32_t count)
 {
-    if( m_intensity )
-    {
-        OPTIX_CHECK( optixDenoiserComputeIntensity(
-                    m_denoiser,
-                    nullptr, // CUDA stream
-                    &m_layers[0].input,
-                    m_intensity,
-                    m_scratch,
-                    m_scratch_size
-                    ) );
-    }
-    
-    if( m_avgColor )
+    ContextLock lock(ctx->mutex);
+
+    std::map<ImageKey, std::vector<uint32_t>, BatchOrder> groups;
+    for (uint32_t i = 0; i < count; i++)
     {
-        OPTIX_CHECK( optixDenoiserComputeAverageColor(
-                    m_denoiser,
-                    nullptr, // CUDA stream
-                    &m_layers[0].input,
-                    m_avgColor,
-                    m_scratch,
-                    m_scratch_size
-                    ) );
+        if (is_complete_image(images[i]))
+            groups[image_key(images[i])].push_back(i);
     }
+    if (groups.empty() || !acquire_backend(ctx, true))
+        return 0;
 
-    /**
-    OPTIX_CHECK( optixDenoiserInvoke(
-                m_denoiser,
-                nullptr, // CUDA stream
-                &m_params,
-                m_state,
-                m_state_size,
-                &m_guideLayer,
-                m_layers.data(),
-                static_cast<unsigned int>( m_layers.size() ),
-                0, // input offset X
-                0, // input offset y
-                m_scratch,
-                m_scratch_size
-                ) );
-    **/
-    OPTIX_CHECK( optixUtilDenoiserInvokeTiled(
-                m_denoiser,
-                nullptr, // CUDA stream
-                &m_params,
-                m_state,
-                m_state_size,
-                &m_guideLayer,
-                m_layers.data(),
-                static_cast<unsigned int>( m_layers.size() ),
-                m_scratch,
-                m_scratch_size,
-                m_overlap,
-                m_tileWidth,
-                m_tileHeight
-                ) );
-
-    CUDA_SYNC_CHECK();
-}
-
-inline float catmull_rom(
-    float       p[4],
-    float       t)
-{
-    return p[1] + 0.5f * t * ( p[2] - p[0] + t * ( 2.f * p[0] - 5.f * p[1] + 4.f * p[2] - p[3] + t * ( 3.f * ( p[1] - p[2]) + p[3] - p[0] ) ) );
-}
-
-// apply flow to image at given pixel position (using bilinear interpolation), write back RGB result.
-static void addFlow(
-    float4*             result,
-    const float4*       image,
-    const float4*       flow,
-    unsigned int        width,
-    unsigned int        height,
-    unsigned int        x,
-    unsigned int        y )
-{
-    float dst_x = float( x ) - flow[x + y * width].x;
-    float dst_y = float( y ) - flow[x + y * width].y;
-
-    float x0 = dst_x - 1.f;
-    float y0 = dst_y - 1.f;
-
-    float r[4][4], g[4][4], b[4][4];
-    for (int j=0; j < 4; j++)
+    const size_t lag = result_lag(ctx);
+    int denoised = 0;
+    for (const auto& group : groups)
     {
-        for (int k=0; k < 4; k++)
+        const std::vector<uint32_t>& indices = group.second;
+        if (!ctx->denoiser->init(batch_data(ctx, images[indices[0]])))
+            continue;
+
+        std::deque<std::pair<uint64_t, uint32_t>> pending;
+        for (size_t k = 0; k <= indices.size(); k++)
         {
-            int tx = static_cast<int>( x0 ) + k;
-            if( tx < 0 )
-                tx = 0;
-            else if( tx >= (int)width )
-                tx = width - 1;
-
-            int ty = static_cast<int>( y0 ) + j;
-            if( ty < 0 )
-                ty = 0;
-            else if( ty >= (int)height )
-                ty = height - 1;
-
-            r[j][k] = image[tx + ty * width].x;
-            g[j][k] = image[tx + ty * width].y;
-            b[j][k] = image[tx + ty * width].z;
+            if (k < indices.size())
+            {
+                const uint64_t frame = ctx->denoiser->submitFrame(batch_data(ctx, images[indices[k]]));
+                if (frame)
+                    pending.push_back(std::make_pair(frame, indices[k]));
+            }
+            while (!pending.empty() && (pending.size() > lag || k == indices.size()))
+            {
+                if (read_frame_result(ctx, pending.front().first, images[pending.front().second]))
+                    denoised++;
+                pending.pop_front();
+            }
         }
     }
-    float tx = dst_x <= 0.f ? 0.f : dst_x - floorf( dst_x );
-
-    r[0][0] = catmull_rom( r[0], tx );
-    r[0][1] = catmull_rom( r[1], tx );
-    r[0][2] = catmull_rom( r[2], tx );
-    r[0][3] = catmull_rom( r[3], tx );
-
-    g[0][0] = catmull_rom( g[0], tx );
-    g[0][1] = catmull_rom( g[1], tx );
-    g[0][2] = catmull_rom( g[2], tx );
-    g[0][3] = catmull_rom( g[3], tx );
+    return denoised;
+}
 
-    b[0][0] = catmull_rom( b[0], tx );
-    b[0][1] = catmull_rom( b[1], tx );
-    b[0][2] = catmull_rom( b[2], tx );
-    b[0][3] = catmull_rom( b[3], tx );
+static void release_job(OptixDenoiserWrapperJob* job)
+{
+    if (job->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete job;
+}
 
-    float ty = dst_y <= 0.f ? 0.f : dst_y - floorf( dst_y );
+// the promise is set last, so a caller returning from wait also sees the callback's effects
+static void complete_job(OptixDenoiserWrapperJob* job, bool denoised)
+{
+    if (job->callback)
+        job->callback(job, denoised ? 1 : 0, job->user_data);
+    job->promise.set_value(denoised);
+    release_job(job);
+}
 
-    result[y * width + x].x = catmull_rom( r[0], ty );
-    result[y * width + x].y = catmull_rom( g[0], ty );
-    result[y * width + x].z = catmull_rom( b[0], ty );
+// Next queued job, sleeping while the queue is empty. nullptr once the worker is to stop and
+// all submitted jobs have been taken.
+static OptixDenoiserWrapperJob* next_job(OptixDenoiserWrapperContext* ctx)
+{
+    for (;;)
+    {
+        if (OptixDenoiserWrapperJob* job = ctx->jobs.pop())
+            return job;
+        std::unique_lock<std::mutex> lock(ctx->worker_mutex);
+        // pairs with the fence in submit_job: either the submitter sees the worker idle and
+        // wakes it, or the worker sees the job here
+        ctx->worker_idle.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        OptixDenoiserWrapperJob* job = ctx->jobs.pop();
+        if (!job)
+        {
+            if (ctx->worker_stop.load())
+                return nullptr;
+            ctx->worker_wake.wait(lock);
+        }
+        ctx->worker_idle.store(false);
+        if (job)
+            return job;
+    }
 }
 
-void OptiXDenoiser::getFlowResults()
+static void run_worker(OptixDenoiserWrapperContext* ctx)
 {
-    if( m_layers.size() == 0 )
-        return;
+    while (OptixDenoiserWrapperJob* job = next_job(ctx))
+    {
+        // A burst of jobs holds the instance until the queue runs dry, so calls on the instance
+        // cannot disturb frames in flight. Jobs of the same shape as their predecessor reuse
+        // its init and overlap in the frame slots.
+        ContextLock lock(ctx->mutex);
+        const bool ready = acquire_backend(ctx, true);
+        const size_t lag = result_lag(ctx);
+        std::deque<std::pair<uint64_t, OptixDenoiserWrapperJob*>> pending;
+        bool initialized = false;
+        ImageKey key;
+
+        auto finish_pending = [&](size_t keep)
+        {
+            while (pending.size() > keep)
+            {
+                OptixDenoiserWrapperJob* done = pending.front().second;
+                const bool denoised = read_frame_result(ctx, pending.front().first, done->image);
+                pending.pop_front();
+                complete_job(done, denoised);
+            }
+        };
 
-    const uint64_t frame_byte_size = m_layers[0].output.width*m_layers[0].output.height*sizeof(float4);
+        for (; job; job = ctx->jobs.pop())
+        {
+            if (!ready)
+            {
+                complete_job(job, false);
+                continue;
+            }
+            if (!initialized || image_key(job->image) != key)
+            {
+                finish_pending(0);
+                key = image_key(job->image);
+                initialized = ctx->denoiser->init(batch_data(ctx, job->image));
+            }
+            if (!initialized)
+            {
+                complete_job(job, false);
+                continue;
+            }
+            const uint64_t frame = ctx->denoiser->submitFrame(batch_data(ctx, job->image));
+            if (!frame)
+            {
+                complete_job(job, false);
+                continue;
+            }
+            pending.push_back(std::make_pair(frame, job));
+            finish_pending(lag);
+        }
+        finish_pending(0);
+    }
+}
 
-    const float4* device_flow = (float4*)m_guideLayer.flow.data;
-    if( !device_flow )
+// lets the worker finish every job submitted so far, then joins it
+static void stop_worker(OptixDenoiserWrapperContext* ctx)
+{
+    if (!ctx->worker.joinable())
         return;
-    float4* flow = new float4[ frame_byte_size ];
-    CUDA_CHECK( cudaMemcpy( flow, device_flow, frame_byte_size, cudaMemcpyDeviceToHost ) );
-
-    float4* image = new float4[ frame_byte_size ];
-
-    for( size_t i=0; i < m_layers.size(); i++ )
     {
-        CUDA_CHECK( cudaMemcpy( image, (float4*)m_layers[i].input.data, frame_byte_size, cudaMemcpyDeviceToHost ) );
-
-        for( unsigned int y=0; y < m_layers[i].input.height; y++ )
-            for( unsigned int x=0; x < m_layers[i].input.width; x++ )
-                addFlow( (float4*)m_host_outputs[i], image, flow, m_layers[i].input.width, m_layers[i].input.height, x, y );
+        std::lock_guard<std::mutex> lock(ctx->worker_mutex);
+        ctx->worker_stop.store(true);
+        ctx->worker_wake.notify_one();
     }
-
-    delete[] image;
-    delete[] flow;
+    ctx->worker.join();
 }
 
-void OptiXDenoiser::getResults()
+optix_denoiser_job optix_denoiser_ctx_submit_job(optix_denoiser_handle ctx, const optix_denoiser_image_desc* image, optix_denoiser_job_callback callback, void* user_data)
 {
-    const uint64_t frame_byte_size = m_layers[0].output.width*m_layers[0].output.height*sizeof(float4);
-    for( size_t i=0; i < m_layers.size(); i++ )
+    if (!image || !is_complete_image(*image))
+        return nullptr;
+    std::call_once(ctx->worker_started, [ctx]() { ctx->worker = std::thread(run_worker, ctx); });
+
+    OptixDenoiserWrapperJob* job = new OptixDenoiserWrapperJob();
+    job->image = *image;
+    job->callback = callback;
+    job->user_data = user_data;
+    job->done = job->promise.get_future().share();
+    ctx->jobs.push(job);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ctx->worker_idle.load())
     {
-        CUDA_CHECK( cudaMemcpy(
-                    m_host_outputs[i],
-                    reinterpret_cast<void*>( m_layers[i].output.data ),
-                    frame_byte_size,
-                    cudaMemcpyDeviceToHost
-                    ) );
+        std::lock_guard<std::mutex> lock(ctx->worker_mutex);
+        ctx->worker_wake.notify_one();
     }
+    return job;
+}
+int optix_denoiser_job_poll(optix_denoiser_job job)
+{
+    if (!job)
+        return 1;
+    const std::shared_future<bool> done = job->done;
+    return done.wait_for(std::chrono::seconds(0)) == std::future_status::ready ? 1 : 0;
+}
+int optix_denoiser_job_wait(optix_denoiser_job job)
+{
+    if (!job)
+        return 0;
+    const std::shared_future<bool> done = job->done;
+    return done.get() ? 1 : 0;
+}
+void optix_denoiser_job_release(optix_denoiser_job job)
+{
+    if (job)
+        release_job(job);
+}
+
+struct OptixDenoiserWrapperDevicePool
+{
+    std::unique_ptr<DenoiserDevicePool> pool;
+};
+
+static DenoiserBackend::Data pool_data(const optix_denoiser_image_desc& image)
+{
+    DenoiserBackend::Data data;
+    data.width = image.width;
+    data.height = image.height;
+    data.color = image.color;
+    data.albedo = image.albedo;
+    data.normal = image.normal;
+    data.outputs.assign(1, image.output);
+    return data;
 }
 
-void OptiXDenoiser::finish() 
+optix_denoiser_device_pool optix_denoiser_device_pool_create(int backend, uint32_t device_count)
+{
+    std::unique_ptr<DenoiserDevicePool> pool = createDenoiserDevicePool(to_backend_kind(backend), device_count);
+    if (!pool)
+        return nullptr;
+    LOG_INFO("Denoiser devices:%zu", pool->size());
+    OptixDenoiserWrapperDevicePool* handle = new OptixDenoiserWrapperDevicePool();
+    handle->pool = std::move(pool);
+    return handle;
+}
+void optix_denoiser_device_pool_destroy(optix_denoiser_device_pool pool)
+{
+    delete pool;
+}
+uint32_t optix_denoiser_device_pool_size(optix_denoiser_device_pool pool)
+{
+    return pool ? uint32_t(pool->pool->size()) : 0;
+}
+int optix_denoiser_device_pool_denoise_batch(optix_denoiser_device_pool pool, const optix_denoiser_image_desc* images, uint32_t count)
+{
+    if (!pool)
+        return 0;
+    std::vector<DenoiserBackend::Data> data;
+    for (uint32_t i = 0; i < count; i++)
+        data.push_back(pool_data(images[i]));
+    return int(pool->pool->denoiseImages(data));
+}
+int optix_denoiser_device_pool_denoise_sharded(optix_denoiser_device_pool pool, const optix_denoiser_image_desc* image)
+{
+    if (!pool || !image)
+        return 0;
+    return pool->pool->denoiseSharded(pool_data(*image)) ? 1 : 0;
+}
+void optix_denoiser_device_pool_get_device_stats(optix_denoiser_device_pool pool, uint32_t device, double* pixels_per_second, uint64_t* pixels_denoised)
 {
-    // Cleanup resources
-    optixDenoiserDestroy( m_denoiser );
-    optixDeviceContextDestroy( m_context );
+    const bool valid = pool && device < pool->pool->size();
+    if (pixels_per_second)
+        *pixels_per_second = valid ? pool->pool->scheduler().throughput(device) : 0.0;
+    if (pixels_denoised)
+        *pixels_denoised = valid ? pool->pool->scheduler().completed(device) : 0;
+}
 
-    CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_intensity)) );
-    CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_avgColor)) );
-    CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_scratch)) );
-    CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_state)) );
-    CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_guideLayer.albedo.data)) );
-    CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_guideLayer.normal.data)) );
-    CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_guideLayer.flow.data)) );
-    for( size_t i=0; i < m_layers.size(); i++ )
-        CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_layers[i].input.data) ) );
-    for( size_t i=0; i < m_layers.size(); i++ )
-        CUDA_CHECK( cudaFree(reinterpret_cast<void*>(m_layers[i].output.data) ) ); 
+void* optix_denoiser_alloc_host_buffer(uint64_t size_in_bytes)
+{
+    return allocHostMemory(size_t(size_in_bytes));
+}
+void optix_denoiser_free_host_buffer(void* ptr)
+{
+    freeHostMemory(ptr);
+}
+void optix_denoiser_trim_device_memory()
+{
+#ifdef OPTIX_DENOISER_WRAPPER_WITH_OPTIX
+    if (isOptiXDenoiserAvailable())
+        trimDeviceMemory();
+#endif
+}
+void optix_denoiser_clear_model_cache()
+{
+    clearDenoiserModelCache();
 }
 
-static OptiXDenoiser::Data s_data;
-static OptiXDenoiser* s_denoiser = nullptr;
-static float* s_output_buffer = nullptr;
+// The handle-less entry points drive a process wide default context.
+static optix_denoiser_handle default_context()
+{
+    static optix_denoiser_handle s_context = optix_denoiser_create();
+    return s_context;
+}
 
+void optix_denoiser_set_backend(int backend)
+{
+    optix_denoiser_ctx_set_backend(default_context(), backend);
+}
+int optix_denoiser_get_backend()
+{
+    return optix_denoiser_ctx_get_backend(default_context());
+}
+void optix_denoiser_set_persistent(int enabled)
+{
+    optix_denoiser_ctx_set_persistent(default_context(), enabled);
+}
+void optix_denoiser_set_host_staging(int enabled)
+{
+    optix_denoiser_ctx_set_host_staging(default_context(), enabled);
+}
+void optix_denoiser_set_memory_budget(uint64_t bytes)
+{
+    optix_denoiser_ctx_set_memory_budget(default_context(), bytes);
+}
+void optix_denoiser_set_temporal(int enabled)
+{
+    optix_denoiser_ctx_set_temporal(default_context(), enabled);
+}
+int optix_denoiser_set_model_file(const char* path)
+{
+    return optix_denoiser_ctx_set_model_file(default_context(), path);
+}
 void optix_denoiser_set_image_size(uint32_t width, uint32_t height)
 {
-    Debug::Log("Width:" + std::to_string(width));
-    Debug::Log("Height:" + std::to_string(height));
-    s_data.width = width;
-    s_data.height = height;
+    optix_denoiser_ctx_set_image_size(default_context(), width, height);
+}
+void optix_denoiser_set_input_format(int format)
+{
+    optix_denoiser_ctx_set_input_format(default_context(), format);
+}
+void optix_denoiser_set_guide_format(int format)
+{
+    optix_denoiser_ctx_set_guide_format(default_context(), format);
+}
+void optix_denoiser_set_output_format(int format)
+{
+    optix_denoiser_ctx_set_output_format(default_context(), format);
+}
+void optix_denoiser_set_input_layout(uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y)
+{
+    optix_denoiser_ctx_set_input_layout(default_context(), row_pitch, origin_x, origin_y);
+}
+void optix_denoiser_set_output_layout(uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y)
+{
+    optix_denoiser_ctx_set_output_layout(default_context(), row_pitch, origin_x, origin_y);
 }
 void optix_denoiser_set_source_data_pointer(float* ptr)
 {
-    s_data.color = ptr;
+    optix_denoiser_ctx_set_source_data_pointer(default_context(), ptr);
 }
 void optix_denoiser_set_normal_data_pointer(float* ptr)
 {
-    s_data.normal = ptr;
+    optix_denoiser_ctx_set_normal_data_pointer(default_context(), ptr);
 }
 void optix_denoiser_set_albedo_data_pointer(float* ptr)
 {
-    s_data.albedo = ptr;
+    optix_denoiser_ctx_set_albedo_data_pointer(default_context(), ptr);
+}
+void optix_denoiser_set_flow_data_pointer(float* ptr)
+{
+    optix_denoiser_ctx_set_flow_data_pointer(default_context(), ptr);
+}
+void optix_denoiser_set_aov_count(uint32_t count)
+{
+    optix_denoiser_ctx_set_aov_count(default_context(), count);
+}
+void optix_denoiser_set_aov_data_pointer(uint32_t index, float* ptr)
+{
+    optix_denoiser_ctx_set_aov_data_pointer(default_context(), index, ptr);
+}
+void optix_denoiser_set_kernel_prediction(int enabled)
+{
+    optix_denoiser_ctx_set_kernel_prediction(default_context(), enabled);
+}
+void optix_denoiser_set_source_device_pointer(void* ptr)
+{
+    optix_denoiser_ctx_set_source_device_pointer(default_context(), ptr);
+}
+void optix_denoiser_set_normal_device_pointer(void* ptr)
+{
+    optix_denoiser_ctx_set_normal_device_pointer(default_context(), ptr);
+}
+void optix_denoiser_set_albedo_device_pointer(void* ptr)
+{
+    optix_denoiser_ctx_set_albedo_device_pointer(default_context(), ptr);
+}
+void optix_denoiser_set_output_device_pointer(void* ptr)
+{
+    optix_denoiser_ctx_set_output_device_pointer(default_context(), ptr);
+}
+int optix_denoiser_query_memory_requirements(uint32_t width, uint32_t height, int guides, uint32_t aovs, uint32_t tile_width, uint32_t tile_height, optix_denoiser_memory_requirements* requirements)
+{
+    return optix_denoiser_ctx_query_memory_requirements(default_context(), width, height, guides, aovs, tile_width, tile_height, requirements);
 }
 void optix_denoiser_init()
 {
-    Debug::Log("Denoiser Init");
-    s_output_buffer = new float[s_data.width * s_data.height * 4];
-    s_data.outputs.push_back(s_output_buffer);
-    if (s_denoiser != nullptr)
-    {
-        delete s_denoiser;
-    }
-    s_denoiser = new OptiXDenoiser();
-    s_denoiser->init(s_data);
+    optix_denoiser_ctx_init(default_context());
 }
 void optix_denoiser_update()
 {
-    s_denoiser->update(s_data);
+    optix_denoiser_ctx_update(default_context());
 }
 void optix_denoiser_exec()
 {
-    Debug::Log("Denoiser Exec");
-    s_denoiser->exec();
+    optix_denoiser_ctx_exec(default_context());
+}
+uint64_t optix_denoiser_exec_async()
+{
+    return optix_denoiser_ctx_exec_async(default_context());
+}
+int optix_denoiser_poll(uint64_t ticket)
+{
+    return optix_denoiser_ctx_poll(default_context(), ticket);
+}
+void optix_denoiser_wait(uint64_t ticket)
+{
+    optix_denoiser_ctx_wait(default_context(), ticket);
 }
 float* optix_denoiser_get_result()
 {
-    s_denoiser->getResults();
-    return s_data.outputs[0];
+    return optix_denoiser_ctx_get_result(default_context());
+}
+float* optix_denoiser_get_aov_result(uint32_t index)
+{
+    return optix_denoiser_ctx_get_aov_result(default_context(), index);
+}
+float* optix_denoiser_exec_region(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    return optix_denoiser_ctx_exec_region(default_context(), x, y, width, height);
+}
+void optix_denoiser_set_pipeline_depth(uint32_t depth)
+{
+    optix_denoiser_ctx_set_pipeline_depth(default_context(), depth);
+}
+uint64_t optix_denoiser_submit_frame()
+{
+    return optix_denoiser_ctx_submit_frame(default_context());
+}
+int optix_denoiser_poll_frame(uint64_t frame)
+{
+    return optix_denoiser_ctx_poll_frame(default_context(), frame);
+}
+const float* optix_denoiser_get_frame_result(uint64_t frame)
+{
+    return optix_denoiser_ctx_get_frame_result(default_context(), frame);
+}
+int optix_denoiser_get_stage_timings(optix_denoiser_stage_timings* timings)
+{
+    return optix_denoiser_ctx_get_stage_timings(default_context(), timings);
+}
+void optix_denoiser_reset_stage_timings()
+{
+    optix_denoiser_ctx_reset_stage_timings(default_context());
 }
 void optix_denoiser_free()
 {
-    delete[] s_output_buffer;
-    s_denoiser->finish();
-    delete s_denoiser;
-    s_denoiser = nullptr;
-    s_data.clear();
+    optix_denoiser_ctx_free(default_context());
+}
+int optix_denoiser_denoise_batch(const optix_denoiser_image_desc* images, uint32_t count)
+{
+    return optix_denoiser_ctx_denoise_batch(default_context(), images, count);
+}
+optix_denoiser_job optix_denoiser_submit_job(const optix_denoiser_image_desc* image, optix_denoiser_job_callback callback, void* user_data)
+{
+    return optix_denoiser_ctx_submit_job(default_context(), image, callback, user_data);
 }
 float* optix_denoiser_test()
 {
@@ -9,23 +9,313 @@
 #include <cmath>
 #include <stdint.h>
 
+#if defined(_WIN32)
 #define OPTIX_DENOISER_WRAPPER_API __declspec(dllexport) 
+#else
+#define OPTIX_DENOISER_WRAPPER_API __attribute__((visibility("default")))
+#endif
+
+// values for optix_denoiser_set_backend / optix_denoiser_get_backend
+#define OPTIX_DENOISER_BACKEND_AUTO     0   // OptiX if a device is present, CPU otherwise
+#define OPTIX_DENOISER_BACKEND_OPTIX    1
+#define OPTIX_DENOISER_BACKEND_CPU      2
+
+// pixel formats for optix_denoiser_set_input_format / _guide_format / _output_format
+#define OPTIX_DENOISER_FORMAT_FLOAT4    0   // default
+#define OPTIX_DENOISER_FORMAT_FLOAT3    1
+#define OPTIX_DENOISER_FORMAT_HALF4     2
+#define OPTIX_DENOISER_FORMAT_HALF3     3
+
+// levels for optix_denoiser_set_log_level
+#define OPTIX_DENOISER_LOG_DEBUG        0   // per-frame messages
+#define OPTIX_DENOISER_LOG_INFO         1
+#define OPTIX_DENOISER_LOG_WARNING      2
+#define OPTIX_DENOISER_LOG_ERROR        3
+#define OPTIX_DENOISER_LOG_NONE         4
+
+// guide bits for optix_denoiser_query_memory_requirements
+#define OPTIX_DENOISER_GUIDE_ALBEDO     1
+#define OPTIX_DENOISER_GUIDE_NORMAL     2   // requires albedo
 
 extern "C" 
 {
+    // Opaque denoiser instance. Every instance owns its own backend, buffers and settings,
+    // so several of them can be driven concurrently from different threads.
+    typedef struct OptixDenoiserWrapperContext* optix_denoiser_handle;
+
+    OPTIX_DENOISER_WRAPPER_API optix_denoiser_handle optix_denoiser_create();
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_destroy(optix_denoiser_handle ctx);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_backend(optix_denoiser_handle ctx, int backend);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_ctx_get_backend(optix_denoiser_handle ctx);
+    // Persistent sessions keep the device context, denoiser and buffers alive across
+    // free/init; init then only rebuilds what changed (resolution, guide set, model kind).
+    // Everything is released by optix_denoiser_destroy, or by free once persistence is disabled.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_persistent(optix_denoiser_handle ctx, int enabled);
+    // Route per frame copies from pageable memory through page-locked staging buffers owned by
+    // the instance. Pointers from optix_denoiser_alloc_host_buffer are always copied directly.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_host_staging(optix_denoiser_handle ctx, int enabled);
+    // Device memory the denoiser may use for its image buffers, scratch and state (0 = no
+    // limit, the default). Larger frames are then denoised in tiles, sized on init to fit the
+    // budget with the least overlap overhead. Takes effect on init.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_memory_budget(optix_denoiser_handle ctx, uint64_t bytes);
+    // Temporal denoising of image sequences (beauty only). Takes effect on init, and every init
+    // starts a new sequence: its first frame is denoised without history. Each following
+    // update/exec denoises the next frame against the previous result, which the instance keeps
+    // in a buffer of its own, so the result handed out by get_result (or written to a device
+    // output) may be modified freely. Motion vectors are optional, see set_flow_data_pointer.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_temporal(optix_denoiser_handle ctx, int enabled);
+    // Denoise with a user trained model file instead of the built-in models (nullptr or "" goes
+    // back to them). The file is memory-mapped and cached process wide by path and contents, so
+    // instances share it and switching to a model loaded before costs no file access. Takes
+    // effect on init; the model defines which guides it expects. Requires the OptiX backend.
+    // Returns 0 if the file cannot be loaded, leaving the current model selected. The file stays
+    // mapped while in use: update a model by renaming a new file over it, never by rewriting
+    // it in place.
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_ctx_set_model_file(optix_denoiser_handle ctx, const char* path);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_image_size(optix_denoiser_handle ctx, uint32_t width, uint32_t height);
+    // Pixel format of the source (and AOV) pointers, of the albedo/normal pointers and of the
+    // results. The data pointers keep their float* type but hold pixels in the given format,
+    // e.g. Unity RGBAHalf textures with OPTIX_DENOISER_FORMAT_HALF4. Takes effect on init.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_input_format(optix_denoiser_handle ctx, int format);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_guide_format(optix_denoiser_handle ctx, int format);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_output_format(optix_denoiser_handle ctx, int format);
+    // Denoise a width x height region of larger images in place: rows are row_pitch pixels
+    // apart (0 = origin_x + width, rows ending with the region) and the region starts at pixel (origin_x, origin_y) of every
+    // data pointer. The input layout covers source, AOVs and guides; the output layout applies
+    // to a device output pointer (the instance owned host output is always tightly packed).
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_input_layout(optix_denoiser_handle ctx, uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_output_layout(optix_denoiser_handle ctx, uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_source_data_pointer(optix_denoiser_handle ctx, float* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_normal_data_pointer(optix_denoiser_handle ctx, float* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_albedo_data_pointer(optix_denoiser_handle ctx, float* ptr);
+    // Temporal mode: per pixel motion from the previous frame to the current one, as float4
+    // pixels (x, y in pixels, z and w unused) in the input layout. nullptr means no motion.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_flow_data_pointer(optix_denoiser_handle ctx, float* ptr);
+    // Arbitrary output variables (e.g. diffuse, specular and emission passes) denoised together
+    // with the source in one invocation, guided by the same albedo/normal. set_aov_count sets
+    // how many there are; each then needs a host pointer in the input format and layout before
+    // init. AOVs use the AOV model, which kernel prediction selects also without AOVs. Both take
+    // effect on init and are not available in temporal mode.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_aov_count(optix_denoiser_handle ctx, uint32_t count);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_aov_data_pointer(optix_denoiser_handle ctx, uint32_t index, float* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_kernel_prediction(optix_denoiser_handle ctx, int enabled);
+    // Zero-copy variants taking CUDA device pointers (width*height float4 pixels) on the
+    // denoiser's device. The buffers are denoised in place, without staging copies, and must be
+    // complete when exec is called (synchronize the stream that wrote them first). A device
+    // output receives the result directly; get_result then returns that device pointer.
+    // Setting a host pointer for the same image switches back to host memory; passing
+    // nullptr as output restores the instance owned host output. Requires the OptiX backend.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_source_device_pointer(optix_denoiser_handle ctx, void* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_normal_device_pointer(optix_denoiser_handle ctx, void* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_albedo_device_pointer(optix_denoiser_handle ctx, void* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_output_device_pointer(optix_denoiser_handle ctx, void* ptr);
+
+    // Memory an init of the instance would take, in bytes, for a width x height image with the
+    // given guides (OPTIX_DENOISER_GUIDE_* bits) and AOV count. A tile size of 0 means untiled,
+    // or tiled to fit the memory budget. Uses the instance's backend, formats, device pointer
+    // settings and budget. No buffers are allocated, but the OptiX backend creates its device
+    // context on first use and may create (and destroy) a denoiser to ask it for the sizes.
+    // Pipelined frames add buffers per slot.
+    typedef struct optix_denoiser_memory_requirements
+    {
+        uint64_t inputs;        // color and AOV inputs
+        uint64_t outputs;       // denoised beauty and AOVs
+        uint64_t guides;        // albedo and normal
+        uint64_t flow;          // temporal mode only
+        uint64_t scratch;
+        uint64_t state;
+        uint64_t model;         // denoiser weights, measured when the denoiser was created
+        uint64_t device_total;  // device memory (the CPU backend has none)
+        uint64_t host_total;    // host memory, including the instance's result buffer
+        uint32_t tile_width;    // tiling init would use, 0 if untiled
+        uint32_t tile_height;
+        uint32_t overlap;
+    } optix_denoiser_memory_requirements;
+
+    // returns 0 if no backend is available
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_ctx_query_memory_requirements(optix_denoiser_handle ctx, uint32_t width, uint32_t height, int guides, uint32_t aovs, uint32_t tile_width, uint32_t tile_height, optix_denoiser_memory_requirements* requirements);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_init(optix_denoiser_handle ctx);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_update(optix_denoiser_handle ctx);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_exec(optix_denoiser_handle ctx);
+    // Asynchronous exec on a stream owned by the instance. Returns a ticket (0 if the instance
+    // is not initialized) that completes in submission order; get_result and update are
+    // ordered after all submitted work, so they may follow exec_async directly.
+    OPTIX_DENOISER_WRAPPER_API uint64_t optix_denoiser_ctx_exec_async(optix_denoiser_handle ctx);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_ctx_poll(optix_denoiser_handle ctx, uint64_t ticket);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_wait(optix_denoiser_handle ctx, uint64_t ticket);
+    OPTIX_DENOISER_WRAPPER_API float*   optix_denoiser_ctx_get_result(optix_denoiser_handle ctx);
+    // Denoised AOV index, fetched by get_result together with the source. Instance owned host
+    // memory in the output format, laid out like the output (see set_output_layout).
+    OPTIX_DENOISER_WRAPPER_API float*   optix_denoiser_ctx_get_aov_result(optix_denoiser_handle ctx, uint32_t index);
+    // Re-denoise only a rectangle of the initialized image, e.g. after a localized edit: the
+    // rectangle's inputs (plus the overlap the model needs) are read from the current data
+    // pointers and the result is merged into the output, whose other pixels keep their previous
+    // result. Cost scales with the rectangle's area. Returns the output like get_result, which
+    // need not be called. Returns nullptr in temporal mode.
+    OPTIX_DENOISER_WRAPPER_API float*   optix_denoiser_ctx_exec_region(optix_denoiser_handle ctx, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    // Pipelined frames: submit_frame copies the frame behind the current data pointers into one
+    // of depth (1..3, default 2) slots and returns at once, so the next frame can be rendered and
+    // uploaded while earlier ones are denoised and read back. Returns a frame id (0 if the
+    // instance is not initialized for the current size). get_frame_result waits for the frame
+    // and returns its denoised beauty, which stays valid until depth further submissions.
+    // Frame 0 is never valid: poll_frame returns 0 and get_frame_result nullptr for it.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_set_pipeline_depth(optix_denoiser_handle ctx, uint32_t depth);
+    OPTIX_DENOISER_WRAPPER_API uint64_t optix_denoiser_ctx_submit_frame(optix_denoiser_handle ctx);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_ctx_poll_frame(optix_denoiser_handle ctx, uint64_t frame);
+    OPTIX_DENOISER_WRAPPER_API const float* optix_denoiser_ctx_get_frame_result(optix_denoiser_handle ctx, uint64_t frame);
+
+    // Duration of one stage in milliseconds: the last frame's, and statistics over the most
+    // recent frames (up to 64)
+    typedef struct optix_denoiser_stage_timing
+    {
+        double   last_ms;
+        double   mean_ms;
+        double   min_ms;
+        double   max_ms;
+        uint64_t samples;       // frames timed since the backend was created or reset
+    } optix_denoiser_stage_timing;
+
+    // Where the time of update / exec / get_result frames goes. intensity and invoke are device
+    // time measured with CUDA events on the OptiX backend, the other stages host time. Pipelined
+    // frames and exec_region are not timed.
+    typedef struct optix_denoiser_stage_timings
+    {
+        optix_denoiser_stage_timing upload;     // update: input copies and conversions
+        optix_denoiser_stage_timing intensity;  // intensity / average color of the input
+        optix_denoiser_stage_timing invoke;     // the denoiser, all tiles and layers
+        optix_denoiser_stage_timing wait;       // exec, wait and get_result blocked on the denoise
+        optix_denoiser_stage_timing download;   // get_result: output copies and conversions
+    } optix_denoiser_stage_timings;
+
+    // Returns 0 if the instance has no backend; timings start over with a new backend (init
+    // after free, unless persistent). Device stages show up once their frame has completed.
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_ctx_get_stage_timings(optix_denoiser_handle ctx, optix_denoiser_stage_timings* timings);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_reset_stage_timings(optix_denoiser_handle ctx);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_ctx_free(optix_denoiser_handle ctx);
+
+    // One image of a batch: host pointers to tightly packed width*height pixels in the formats
+    // set on the instance. albedo and normal are optional.
+    typedef struct optix_denoiser_image_desc
+    {
+        uint32_t width;
+        uint32_t height;
+        float*   color;
+        float*   albedo;
+        float*   normal;
+        float*   output;     // receives the denoised image
+    } optix_denoiser_image_desc;
+
+    // Denoise many images in one call, e.g. the lightmaps of a bake. Images are grouped by
+    // guide set and size, largest sizes first; each group reuses the instance's context,
+    // denoiser and frame buffers, resizing them where they fit, and the images of a group are
+    // pipelined (see set_pipeline_depth). Returns the number of images
+    // denoised. This replaces the instance's current session: call init again afterwards.
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_ctx_denoise_batch(optix_denoiser_handle ctx, const optix_denoiser_image_desc* images, uint32_t count);
+
+    // Background jobs: submit_job queues one image for the instance's worker thread and returns
+    // without waiting for earlier jobs, so any number of threads may submit concurrently. A
+    // submit allocates the job, starts the worker on first use and enqueues it lock-free; only
+    // when the worker is asleep does it take the worker's wake mutex to notify it, which the
+    // worker never holds while denoising. The worker denoises jobs in queue order, pipelining
+    // consecutive jobs of the same shape, and writes the result to image->output. Like
+    // denoise_batch, jobs replace the instance's current session. Returns nullptr if the image
+    // is incomplete.
+    // Completion is signalled both ways: the optional callback runs on the worker thread
+    // (denoised is 0 on failure; it may submit further jobs but must not call other functions
+    // of the instance), and the returned job acts as a future for poll/wait. Every job must be
+    // released once the caller no longer needs it, also when a callback is used.
+    typedef struct OptixDenoiserWrapperJob* optix_denoiser_job;
+    typedef void(*optix_denoiser_job_callback)(optix_denoiser_job job, int denoised, void* user_data);
+
+    OPTIX_DENOISER_WRAPPER_API optix_denoiser_job optix_denoiser_ctx_submit_job(optix_denoiser_handle ctx, const optix_denoiser_image_desc* image, optix_denoiser_job_callback callback, void* user_data);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_job_poll(optix_denoiser_job job);
+    // block until the job is done; returns 1 if it was denoised
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_job_wait(optix_denoiser_job job);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_job_release(optix_denoiser_job job);
+
+    // Device pools spread work over several GPUs, one denoiser per device: denoise_batch places
+    // each image on the device predicted to finish it first, denoise_sharded splits the rows of
+    // one large image among the devices in proportion to their measured speed. backend is an
+    // OPTIX_DENOISER_BACKEND_* value; with OptiX the pool uses up to device_count CUDA devices
+    // (0 = all), with the CPU backend device_count simulated devices. Images are float4. A pool
+    // is used by one thread at a time; returns nullptr if no device is available.
+    typedef struct OptixDenoiserWrapperDevicePool* optix_denoiser_device_pool;
+
+    OPTIX_DENOISER_WRAPPER_API optix_denoiser_device_pool optix_denoiser_device_pool_create(int backend, uint32_t device_count);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_device_pool_destroy(optix_denoiser_device_pool pool);
+    OPTIX_DENOISER_WRAPPER_API uint32_t optix_denoiser_device_pool_size(optix_denoiser_device_pool pool);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_device_pool_denoise_batch(optix_denoiser_device_pool pool, const optix_denoiser_image_desc* images, uint32_t count);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_device_pool_denoise_sharded(optix_denoiser_device_pool pool, const optix_denoiser_image_desc* image);
+    // load statistics of one device: estimated pixels per second and pixels denoised so far
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_device_pool_get_device_stats(optix_denoiser_device_pool pool, uint32_t device, double* pixels_per_second, uint64_t* pixels_denoised);
+
+    // Page-locked host memory (plain heap memory without a CUDA device). Rendering directly
+    // into such buffers lets uploads and readbacks run at full transfer speed.
+    OPTIX_DENOISER_WRAPPER_API void*    optix_denoiser_alloc_host_buffer(uint64_t size_in_bytes);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_free_host_buffer(void* ptr);
+
+    // Device buffers of all instances are sub-allocated from per device slabs that outlive
+    // their sessions, so init and free do not go through the CUDA allocator. This returns the
+    // slabs no session is using to the driver, e.g. before handing the GPU to other work.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_trim_device_memory();
+
+    // Forget all cached model files. Models selected by an instance stay loaded until it
+    // selects another one or is destroyed.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_clear_model_cache();
+
+    // Handle-less API, operates on a process wide default instance.
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_backend(int backend);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_get_backend();
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_persistent(int enabled);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_host_staging(int enabled);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_memory_budget(uint64_t bytes);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_temporal(int enabled);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_set_model_file(const char* path);
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_image_size(uint32_t width, uint32_t height);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_input_format(int format);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_guide_format(int format);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_output_format(int format);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_input_layout(uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_output_layout(uint32_t row_pitch, uint32_t origin_x, uint32_t origin_y);
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_source_data_pointer(float* ptr);
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_normal_data_pointer(float* ptr);
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_albedo_data_pointer(float* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_flow_data_pointer(float* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_aov_count(uint32_t count);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_aov_data_pointer(uint32_t index, float* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_kernel_prediction(int enabled);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_source_device_pointer(void* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_normal_device_pointer(void* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_albedo_device_pointer(void* ptr);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_output_device_pointer(void* ptr);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_query_memory_requirements(uint32_t width, uint32_t height, int guides, uint32_t aovs, uint32_t tile_width, uint32_t tile_height, optix_denoiser_memory_requirements* requirements);
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_init();
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_update();
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_exec();
+    OPTIX_DENOISER_WRAPPER_API uint64_t optix_denoiser_exec_async();
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_poll(uint64_t ticket);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_wait(uint64_t ticket);
     OPTIX_DENOISER_WRAPPER_API float*   optix_denoiser_get_result();
+    OPTIX_DENOISER_WRAPPER_API float*   optix_denoiser_get_aov_result(uint32_t index);
+    OPTIX_DENOISER_WRAPPER_API float*   optix_denoiser_exec_region(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_set_pipeline_depth(uint32_t depth);
+    OPTIX_DENOISER_WRAPPER_API uint64_t optix_denoiser_submit_frame();
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_poll_frame(uint64_t frame);
+    OPTIX_DENOISER_WRAPPER_API const float* optix_denoiser_get_frame_result(uint64_t frame);
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_get_stage_timings(optix_denoiser_stage_timings* timings);
+    OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_reset_stage_timings();
     OPTIX_DENOISER_WRAPPER_API void     optix_denoiser_free();
+    OPTIX_DENOISER_WRAPPER_API int      optix_denoiser_denoise_batch(const optix_denoiser_image_desc* images, uint32_t count);
+    OPTIX_DENOISER_WRAPPER_API optix_denoiser_job optix_denoiser_submit_job(const optix_denoiser_image_desc* image, optix_denoiser_job_callback callback, void* user_data);
     OPTIX_DENOISER_WRAPPER_API float*   optix_denoiser_test();
     //Create a callback delegate
     typedef void(*FuncCallBack)(const char* message, int color, int size);
-    static FuncCallBack callbackInstance = nullptr;
+    // Messages reach the callback from a background thread, shortly after they were logged.
     OPTIX_DENOISER_WRAPPER_API void RegisterDebugCallback(FuncCallBack cb);
+    // Drop messages below level (OPTIX_DENOISER_LOG_*) at run time; levels below the build's
+    // OPTIX_DENOISER_LOG_LEVEL are compiled out already.
+    OPTIX_DENOISER_WRAPPER_API void optix_denoiser_set_log_level(int level);
+    // pass all queued messages to the callback before returning, e.g. before unregistering it
+    OPTIX_DENOISER_WRAPPER_API void optix_denoiser_flush_log();
 }
 
@@ -0,0 +1,25 @@
+#pragma once
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// call fn( y_begin, y_end ) for contiguous bands of rows, one band per hardware thread
+template< typename Fn >
+void parallelRows( unsigned int rows, const Fn& fn )
+{
+    unsigned int workers = std::max( 1u, std::thread::hardware_concurrency() );
+    workers = std::min( workers, rows );
+    if( workers <= 1 )
+    {
+        fn( 0u, rows );
+        return;
+    }
+
+    const unsigned int band = ( rows + workers - 1 ) / workers;
+    std::vector< std::thread > threads;
+    for( unsigned int y = band; y < rows; y += band )
+        threads.emplace_back( [&fn, y, band, rows]() { fn( y, std::min( rows, y + band ) ); } );
+    fn( 0u, std::min( rows, band ) );
+    for( size_t i = 0; i < threads.size(); i++ )
+        threads[i].join();
+}
@@ -0,0 +1,226 @@
+#include "pixel_format.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+uint16_t floatToHalf( float value )
+{
+    uint32_t bits;
+    memcpy( &bits, &value, sizeof( bits ) );
+
+    const uint32_t sign     = ( bits >> 16 ) & 0x8000u;
+    const uint32_t mantissa = bits & 0x007fffffu;
+    const int      exponent = int( ( bits >> 23 ) & 0xffu ) - 127 + 15;
+
+    if( ( ( bits >> 23 ) & 0xffu ) == 0xffu )                      // inf, nan
+        return uint16_t( sign | 0x7c00u | ( mantissa ? 0x0200u : 0u ) );
+    if( exponent >= 0x1f )                                          // overflow
+        return uint16_t( sign | 0x7c00u );
+    if( exponent <= 0 )
+    {
+        if( exponent < -10 )                                        // underflow to zero
+            return uint16_t( sign );
+        // denormal: shift the implicit leading one in, then round
+        const uint32_t m     = mantissa | 0x00800000u;
+        const int      shift = 14 - exponent;
+        uint32_t       half  = m >> shift;
+        const uint32_t rest  = m & ( ( 1u << shift ) - 1u );
+        const uint32_t mid   = 1u << ( shift - 1 );
+        if( rest > mid || ( rest == mid && ( half & 1u ) ) )
+            half++;
+        return uint16_t( sign | half );
+    }
+
+    uint32_t half = sign | ( uint32_t( exponent ) << 10 ) | ( mantissa >> 13 );
+    const uint32_t rest = mantissa & 0x1fffu;
+    if( rest > 0x1000u || ( rest == 0x1000u && ( half & 1u ) ) )
+        half++;                                                     // may carry into the exponent, which is correct
+    return uint16_t( half );
+}
+
+float halfToFloat( uint16_t value )
+{
+    const uint32_t sign     = uint32_t( value & 0x8000u ) << 16;
+    uint32_t       exponent = ( value >> 10 ) & 0x1fu;
+    uint32_t       mantissa = value & 0x03ffu;
+
+    uint32_t bits;
+    if( exponent == 0x1fu )
+        bits = sign | 0x7f800000u | ( mantissa << 13 );
+    else if( exponent != 0 )
+        bits = sign | ( ( exponent + 127 - 15 ) << 23 ) | ( mantissa << 13 );
+    else if( mantissa == 0 )
+        bits = sign;
+    else
+    {
+        // denormal: normalize
+        exponent = 127 - 15 + 1;
+        while( !( mantissa & 0x0400u ) )
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | ( exponent << 23 ) | ( ( mantissa & 0x03ffu ) << 13 );
+    }
+
+    float result;
+    memcpy( &result, &bits, sizeof( result ) );
+    return result;
+}
+
+void convertToFloat4( float4* dst, const void* src, DenoiserPixelFormat format, size_t pixels )
+{
+    switch( format )
+    {
+    case DenoiserPixelFormat::Float4:
+        memcpy( dst, src, pixels * sizeof( float4 ) );
+        break;
+    case DenoiserPixelFormat::Float3:
+    {
+        const float* s = static_cast<const float*>( src );
+        for( size_t i=0; i < pixels; i++, s += 3 )
+            dst[i] = float4{ s[0], s[1], s[2], 1.f };
+        break;
+    }
+    case DenoiserPixelFormat::Half4:
+    {
+        const uint16_t* s = static_cast<const uint16_t*>( src );
+        for( size_t i=0; i < pixels; i++, s += 4 )
+            dst[i] = float4{ halfToFloat( s[0] ), halfToFloat( s[1] ), halfToFloat( s[2] ), halfToFloat( s[3] ) };
+        break;
+    }
+    case DenoiserPixelFormat::Half3:
+    {
+        const uint16_t* s = static_cast<const uint16_t*>( src );
+        for( size_t i=0; i < pixels; i++, s += 3 )
+            dst[i] = float4{ halfToFloat( s[0] ), halfToFloat( s[1] ), halfToFloat( s[2] ), 1.f };
+        break;
+    }
+    }
+}
+
+void convertFromFloat4( void* dst, const float4* src, DenoiserPixelFormat format, size_t pixels )
+{
+    switch( format )
+    {
+    case DenoiserPixelFormat::Float4:
+        memcpy( dst, src, pixels * sizeof( float4 ) );
+        break;
+    case DenoiserPixelFormat::Float3:
+    {
+        float* d = static_cast<float*>( dst );
+        for( size_t i=0; i < pixels; i++, d += 3 )
+        {
+            d[0] = src[i].x;
+            d[1] = src[i].y;
+            d[2] = src[i].z;
+        }
+        break;
+    }
+    case DenoiserPixelFormat::Half4:
+    {
+        uint16_t* d = static_cast<uint16_t*>( dst );
+        for( size_t i=0; i < pixels; i++, d += 4 )
+        {
+            d[0] = floatToHalf( src[i].x );
+            d[1] = floatToHalf( src[i].y );
+            d[2] = floatToHalf( src[i].z );
+            d[3] = floatToHalf( src[i].w );
+        }
+        break;
+    }
+    case DenoiserPixelFormat::Half3:
+    {
+        uint16_t* d = static_cast<uint16_t*>( dst );
+        for( size_t i=0; i < pixels; i++, d += 3 )
+        {
+            d[0] = floatToHalf( src[i].x );
+            d[1] = floatToHalf( src[i].y );
+            d[2] = floatToHalf( src[i].z );
+        }
+        break;
+    }
+    }
+}
+
+void convertImageToFloat4( float4* dst, const void* src, size_t srcRowStride, DenoiserPixelFormat format,
+                           unsigned int width, unsigned int height )
+{
+    if( srcRowStride == size_t( width ) * pixelSizeInBytes( format ) )
+    {
+        convertToFloat4( dst, src, format, size_t( width ) * height );
+        return;
+    }
+    const char* src_bytes = static_cast<const char*>( src );
+    for( unsigned int y=0; y < height; y++ )
+        convertToFloat4( dst + size_t( y ) * width, src_bytes + y * srcRowStride, format, width );
+}
+
+void convertImageFromFloat4( void* dst, size_t dstRowStride, const float4* src, DenoiserPixelFormat format,
+                             unsigned int width, unsigned int height )
+{
+    if( dstRowStride == size_t( width ) * pixelSizeInBytes( format ) )
+    {
+        convertFromFloat4( dst, src, format, size_t( width ) * height );
+        return;
+    }
+    char* dst_bytes = static_cast<char*>( dst );
+    for( unsigned int y=0; y < height; y++ )
+        convertFromFloat4( dst_bytes + y * dstRowStride, src + size_t( y ) * width, format, width );
+}
+
+void copyImageRows( void* dst, size_t dstRowStride, const void* src, size_t srcRowStride,
+                    size_t rowBytes, unsigned int height )
+{
+    if( dstRowStride == rowBytes && srcRowStride == rowBytes )
+    {
+        memcpy( dst, src, rowBytes * height );
+        return;
+    }
+    char*       dst_bytes = static_cast<char*>( dst );
+    const char* src_bytes = static_cast<const char*>( src );
+    for( unsigned int y=0; y < height; y++ )
+        memcpy( dst_bytes + y * dstRowStride, src_bytes + y * srcRowStride, rowBytes );
+}
+
+DenoiserExposure computeImageExposure( const void* src, size_t srcRowStride, DenoiserPixelFormat format,
+                                       unsigned int width, unsigned int height )
+{
+    double luminance_sum   = 0.0;
+    size_t luminance_count = 0;
+    double color_sum[3]    = { 0.0, 0.0, 0.0 };
+    size_t color_count[3]  = { 0, 0, 0 };
+
+    std::vector< float4 > row( width );
+    const char* src_bytes = static_cast<const char*>( src );
+    for( unsigned int y=0; y < height; y++ )
+    {
+        convertToFloat4( row.data(), src_bytes + y * srcRowStride, format, width );
+        for( unsigned int x=0; x < width; x++ )
+        {
+            const float4& c = row[x];
+            const float   luminance = 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+            if( luminance > 1e-8f && std::isfinite( luminance ) )
+            {
+                luminance_sum += std::log( luminance );
+                luminance_count++;
+            }
+            const float channels[3] = { c.x, c.y, c.z };
+            for( int k=0; k < 3; k++ )
+            {
+                if( channels[k] > 1e-8f && std::isfinite( channels[k] ) )
+                {
+                    color_sum[k] += std::log( channels[k] );
+                    color_count[k]++;
+                }
+            }
+        }
+    }
+
+    DenoiserExposure exposure;
+    exposure.intensity = luminance_count ? 0.18f / float( std::exp( luminance_sum / double( luminance_count ) ) ) : 1.0f;
+    for( int k=0; k < 3; k++ )
+        exposure.averageColor[k] = color_count[k] ? float( color_sum[k] / double( color_count[k] ) ) : 0.f;
+    return exposure;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "denoiser_backend.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// IEEE 754 binary16 <-> binary32, round to nearest even
+uint16_t floatToHalf( float value );
+float    halfToFloat( uint16_t value );
+
+// expand pixels stored in format to float4 (alpha 1 for three channel formats)
+void convertToFloat4( float4* dst, const void* src, DenoiserPixelFormat format, size_t pixels );
+
+// store float4 pixels in format (alpha dropped for three channel formats)
+void convertFromFloat4( void* dst, const float4* src, DenoiserPixelFormat format, size_t pixels );
+
+// as above for a width x height image whose rows in the formatted memory are rowStride bytes
+// apart; the float4 side is tightly packed
+void convertImageToFloat4( float4* dst, const void* src, size_t srcRowStride, DenoiserPixelFormat format,
+                           unsigned int width, unsigned int height );
+void convertImageFromFloat4( void* dst, size_t dstRowStride, const float4* src, DenoiserPixelFormat format,
+                             unsigned int width, unsigned int height );
+
+// copy height rows of rowBytes bytes between memory with the given row strides
+void copyImageRows( void* dst, size_t dstRowStride, const void* src, size_t srcRowStride,
+                    size_t rowBytes, unsigned int height );
+
+// Exposure of a width x height color image whose rows are rowStride bytes apart, as the
+// backends derive it: the counterpart of optixDenoiserComputeIntensity and
+// optixDenoiserComputeAverageColor, over the finite positive values
+DenoiserExposure computeImageExposure( const void* src, size_t srcRowStride, DenoiserPixelFormat format,
+                                       unsigned int width, unsigned int height );
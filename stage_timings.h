@@ -0,0 +1,120 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+// Stages a denoised frame passes through, in order. Upload, Wait and Download are host time;
+// Intensity and Invoke are device time on the OptiX backend (the worker's time on the CPU).
+enum class DenoiserStage
+{
+    Upload,     // update: input copies and conversions
+    Intensity,  // intensity / average color of the input
+    Invoke,     // the denoiser itself, all tiles and layers
+    Wait,       // caller blocked until submitted work completed
+    Download,   // getResults: output copies and conversions
+    Count
+};
+
+// Durations of one stage in milliseconds: the last sample, and statistics over the most
+// recent samples (at most StageTimings::kWindow of them)
+struct StageStatistics
+{
+    double   last    = 0.0;
+    double   mean    = 0.0;
+    double   min     = 0.0;
+    double   max     = 0.0;
+    uint64_t samples = 0;     // recorded since the last reset, not only those in the window
+};
+
+// Rolling per stage timings of a backend. Samples may be recorded from worker threads while
+// another thread reads the statistics.
+class StageTimings
+{
+public:
+    static const size_t kWindow = 64;
+
+    void record( DenoiserStage stage, double milliseconds )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        Stage& s = m_stages[size_t( stage )];
+        s.window[s.samples % kWindow] = milliseconds;
+        s.samples++;
+    }
+
+    StageStatistics statistics( DenoiserStage stage ) const
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        const Stage&    s = m_stages[size_t( stage )];
+        StageStatistics result;
+        result.samples = s.samples;
+        if( s.samples == 0 )
+            return result;
+
+        const size_t count = s.samples < kWindow ? size_t( s.samples ) : kWindow;
+        result.last = s.window[( s.samples - 1 ) % kWindow];
+        result.min  = s.window[0];
+        result.max  = s.window[0];
+        double sum  = 0.0;
+        for( size_t i=0; i < count; i++ )
+        {
+            sum += s.window[i];
+            result.min = std::min( result.min, s.window[i] );
+            result.max = std::max( result.max, s.window[i] );
+        }
+        result.mean = sum / double( count );
+        return result;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        for( size_t i=0; i < size_t( DenoiserStage::Count ); i++ )
+            m_stages[i].samples = 0;
+    }
+
+private:
+    struct Stage
+    {
+        double   window[kWindow];
+        uint64_t samples = 0;
+    };
+
+    Stage              m_stages[size_t( DenoiserStage::Count )];
+    mutable std::mutex m_mutex;
+};
+
+// Host time from construction to destruction (or stop), recorded as one sample of stage
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer( StageTimings& timings, DenoiserStage stage )
+        : m_timings( &timings )
+        , m_stage( stage )
+        , m_start( std::chrono::steady_clock::now() )
+    {
+    }
+
+    ~ScopedStageTimer() { stop(); }
+
+    void stop()
+    {
+        if( !m_timings )
+            return;
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_start;
+        m_timings->record( m_stage, elapsed.count() );
+        m_timings = nullptr;
+    }
+
+    // drop the sample, e.g. when there turned out to be nothing to time
+    void cancel() { m_timings = nullptr; }
+
+private:
+    ScopedStageTimer( const ScopedStageTimer& ) = delete;
+    ScopedStageTimer& operator=( const ScopedStageTimer& ) = delete;
+
+    StageTimings*                         m_timings;
+    DenoiserStage                         m_stage;
+    std::chrono::steady_clock::time_point m_start;
+};
@@ -104,7 +104,11 @@ int main()
          fprintf(stderr, "ERR : %s\n", err);
          FreeEXRErrorMessage(err); // release memory of error message.
       }
+      return 1;
    }
+   // keep the denoiser alive between the two runs below
+   optix_denoiser_set_persistent(1);
+
    optix_denoiser_set_image_size(w, h);
    optix_denoiser_set_source_data_pointer(imageData);
    optix_denoiser_init();